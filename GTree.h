@@ -1,39 +1,70 @@
 #ifndef _GTREE_H
 #define _GTREE_H
 
+#include <algorithm>
 #include <functional>
+#include <deque>
+#include <future>
 #include <iostream>
+#include <memory>
 #include <queue>
 #include <iterator>
+#include <thread>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "common.h"
+#include "NodePool.h"
+#include "Reclaimer.h"
+#include "GTreeSnapshot.h"
 
 using namespace std;
 
 namespace gtree {
 
-	template<class IndexT, class ValueT = Void, class Comp = less<IndexT>, class Plus = plus<ValueT>>
+	//OrderStatistics keeps subtree sizes in the nodes, needed by kth, rank, countRange and size
+	//SplayPolicy decides whether reads splay, see common.h
+	template<class IndexT, class ValueT = Void, class Comp = less<IndexT>, class Plus = plus<ValueT>,
+		class Alloc = allocator<pair<const IndexT, ValueT>>, bool OrderStatistics = false,
+		class SplayPolicy = SplayAlways>
 	class GTree {
+	public:
+		typedef Alloc allocator_type;
+		typedef GTreeSnapshot<IndexT, ValueT, Comp, Plus, Alloc> Snapshot;
+
 	private:
-		struct Node {
+		//value and totalValue come from _gtree_value, which stores nothing for Void
+		struct Node : _gtree_size<OrderStatistics>, _gtree_prefix<Comp>, _gtree_value<ValueT> {
 			Node* left;
 			Node* right;
 			Node* parent;
 			IndexT key;
-			ValueT value, totalValue;
 
-			Node(const IndexT& keyInit, const ValueT& valueInit) :
-				left(0), right(0), parent(0),
-				key(keyInit), value(valueInit), totalValue(valueInit) {}
+			//the key comes first, whatever follows is handed to the value's constructor
+			template<class K, class... Args, class = typename enable_if<!is_same<typename decay<K>::type, Node>::value>::type>
+			Node(K&& keyInit, Args&&... valueInit) :
+				_gtree_value<ValueT>(forward<Args>(valueInit)...),
+				left(0), right(0), parent(0), key(forward<K>(keyInit)) {
+				this->setPrefix(key);
+			}
 
 		};
 
+		typedef NodePool<Node, Alloc> Pool;
+		typedef typename _gtree_prefix<Comp>::Probe Probe;
+		typedef queue<Node*, deque<Node*, typename allocator_traits<Alloc>::template rebind_alloc<Node*>>> NodeQueue;
+		typedef vector<Node*, typename allocator_traits<Alloc>::template rebind_alloc<Node*>> NodeVector;
+
+		enum SetOperation { Union, Intersection, Difference };
+
 		struct GTreeOwner {
 			//Rule of thumb: private functions do not splay their results
 
 			Comp smaller;
 			Plus add;
+			SplayPolicy splayOnRead;
+			Pool* pool;
 			Node* root;
 
 			void leftRotate(Node* x){
@@ -94,10 +125,20 @@ namespace gtree {
 				}
 			}
 
+			//splays a node reached by a read, if the policy wants it
+			void access(Node* x){
+				if (!x) return;
+				size_t depth = 0;
+				if (SplayPolicy::usesDepth){
+					for (Node* p = x->parent; p; p = p->parent) depth++;
+				}
+				if (splayOnRead(depth)) splay(x);
+			}
+
 			//detaches the subtree from its parent
 			//the newly formed tree with u as its root is returned
 			GTreeOwner detach(Node* u){
-				if (!u) return GTreeOwner();
+				if (!u) return GTreeOwner(pool);
 				if (u->parent){
 					if (u == u->parent->left) u->parent->left = 0;
 					else if (u == u->parent->right) u->parent->right = 0;
@@ -107,7 +148,7 @@ namespace gtree {
 				else {
 					root = 0;
 				}
-				return GTreeOwner(u);
+				return GTreeOwner(pool, u);
 			}
 
 			//attaches the given tree as the left/right child of the given node
@@ -124,6 +165,7 @@ namespace gtree {
 				else {
 					if (left) u->left = tree.root;
 					else u->right = tree.root;
+					if (tree.root) tree.root->parent = u;
 					repair<true>(u);
 				}
 				tree.root = 0;
@@ -144,22 +186,47 @@ namespace gtree {
 				return oldTree;
 			}
 
-			Node* minimum(Node* u)const{
+			static Node* minimum(Node* u){
 				if (!u) return 0;
 				while (u->left) u = u->left;
 				return u;
 			}
 
-			Node* maximum(Node* u)const{
+			static Node* maximum(Node* u){
 				if (!u) return 0;
 				while (u->right) u = u->right;
 				return u;
 			}
 
-			Node* find(const IndexT& key, Node* node)const{
+			//in-order neighbours, found without splaying
+			static Node* successor(Node* u){
+				if (u->right) return minimum(u->right);
+				while (u->parent && u == u->parent->right) u = u->parent;
+				return u->parent;
+			}
+
+			static Node* predecessor(Node* u){
+				if (u->left) return maximum(u->left);
+				while (u->parent && u == u->parent->left) u = u->parent;
+				return u->parent;
+			}
+
+			//negative if the key comes before the node's, through the inline prefixes if there are any (see PrefixLess)
+			template<class K>
+			int order(const K& key, const Probe& probe, const Node* node)const{
+				if (_gtree_prefix<Comp>::enabled) return node->comparePrefix(probe, node->key);
+				if (smaller(node->key, key)) return 1;
+				return smaller(key, node->key) ? -1 : 0;
+			}
+
+			//K is IndexT or, with a transparent comparator, anything it compares with IndexT
+			template<class K>
+			Node* find(const K& key, Node* node)const{
+				Probe probe(key);
 				while (node) {
-					if (smaller(node->key, key)) node = node->right;
-					else if (smaller(key, node->key)) node = node->left;
+					int c = order(key, probe, node);
+					if (c > 0) node = node->right;
+					else if (c < 0) node = node->left;
 					else {
 						return node;
 					}
@@ -167,18 +234,20 @@ namespace gtree {
 				return 0;
 			}
 
-			template<bool goLeftOnEqual, bool keepEqual>
-			Node* find2(const IndexT& key, Node* node)const{
+			template<bool goLeftOnEqual, bool keepEqual, class K>
+			Node* find2(const K& key, Node* node)const{
+				Probe probe(key);
 				Node* result = 0;
 				while (node){
-					if (smaller(node->key, key)){
+					int c = order(key, probe, node);
+					if (c > 0){
 						if (goLeftOnEqual) result = node;
 						node = node->right;
 					}
-					else if (smaller(key, node->key)){
+					else if (c < 0){
 						if (!goLeftOnEqual) result = node;
 						node = node->left;
-					}					
+					}
 					else {
 						if (keepEqual) return node;
 						node = goLeftOnEqual ? node->left : node->right;
@@ -187,10 +256,20 @@ namespace gtree {
 				return result;
 			}
 
+			static size_t sizeOf(Node* u){
+				return u ? u->getSize() : 0;
+			}
+
+			//a set without order statistics has nothing to repair, not even up the path
 			template<bool propagate>
 			void repair(Node* node){
+				if (!OrderStatistics && !_gtree_value<ValueT>::enabled) return;
 				if (!node) return;
-				if (!node->left && !node->right){
+				node->setSize(sizeOf(node->left) + 1 + sizeOf(node->right));
+				if (!_gtree_value<ValueT>::enabled){
+					//sets keep only the sizes
+				}
+				else if (!node->left && !node->right){
 					node->totalValue = node->value;
 				}
 				else if (!node->left){
@@ -205,6 +284,83 @@ namespace gtree {
 				if (propagate) repair<true>(node->parent);
 			}
 
+			//links the n nodes, sorted by key, into a perfectly balanced tree
+			//aggregates are computed bottom-up on the way, O(n)
+			Node* link(Node** nodes, size_t n, Node* parent){
+				if (!n) return 0;
+				size_t mid = n / 2;
+				Node* node = nodes[mid];
+				node->parent = parent;
+				node->left = link(nodes, mid, node);
+				node->right = link(nodes + mid + 1, n - mid - 1, node);
+				repair<false>(node);
+				return node;
+			}
+
+			//builds a perfectly balanced tree out of the next n pairs, taken in order
+			//the nodes get allocated in key order, aggregates are computed bottom-up
+			template<class ForwardIt>
+			Node* stream(ForwardIt& it, size_t n, Node* parent){
+				if (!n) return 0;
+				size_t mid = n / 2;
+				Node* left = stream(it, mid, 0);
+				GTreeOwner built(pool, left); //frees what was built so far if anything throws
+				Node* node = pool->create(it->first, it->second);
+				++it;
+				node->left = left;
+				if (left) left->parent = node;
+				built.root = node;
+				node->right = stream(it, n - mid - 1, node);
+				built.root = 0;
+				node->parent = parent;
+				repair<false>(node);
+				return node;
+			}
+
+			//fills an empty tree with the (key, value) pairs from the range
+			//O(n) if the keys are sorted, they get stable sorted otherwise
+			//of equal keys the last one wins, just like with insert
+			//returns the number of distinct keys
+			template<class InputIt>
+			size_t build(InputIt first, InputIt last){
+				return build(first, last, typename iterator_traits<InputIt>::iterator_category());
+			}
+
+			//strictly increasing keys are streamed straight into the tree
+			template<class ForwardIt>
+			size_t build(ForwardIt first, ForwardIt last, forward_iterator_tag){
+				size_t n = 0;
+				for (ForwardIt it = first; it != last; ++it, ++n){
+					ForwardIt next = it;
+					if (++next != last && !smaller(it->first, next->first)){
+						return build(first, last, input_iterator_tag());
+					}
+				}
+				root = stream(first, n, 0);
+				return n;
+			}
+
+			template<class InputIt>
+			size_t build(InputIt first, InputIt last, input_iterator_tag){
+				NodeVector nodes(pool->allocator());
+				try {
+					for (; first != last; ++first) nodes.push_back(pool->create(first->first, first->second));
+				}
+				catch (...) {
+					for (Node* node : nodes) pool->destroy(node);
+					throw;
+				}
+				auto byKey = [this](const Node* a, const Node* b){ return smaller(a->key, b->key); };
+				if (!is_sorted(nodes.begin(), nodes.end(), byKey)) stable_sort(nodes.begin(), nodes.end(), byKey);
+				size_t n = 0;
+				for (size_t i = 0; i < nodes.size(); i++){
+					if (i + 1 < nodes.size() && !byKey(nodes[i], nodes[i + 1])) pool->destroy(nodes[i]);
+					else nodes[n++] = nodes[i];
+				}
+				root = link(nodes.data(), n, 0);
+				return n;
+			}
+
 			void join(GTreeOwner& tree){
 				if (!root){
 					root = tree.root;
@@ -216,61 +372,371 @@ namespace gtree {
 				}
 			}
 
+			//merges the nodes of the other tree into ours, on equal keys the other tree wins
+			//divide and conquer over the other tree: ours is split at the key of its root,
+			//both halves are merged with its subtrees and hung below that root
+			//returns the number of keys of ours that got replaced
+			size_t upsert(GTreeOwner& tree){
+				Node* b = tree.root;
+				if (!b) return 0;
+				if (!root){
+					root = b;
+					tree.root = 0;
+					return 0;
+				}
+				GTreeOwner treeLeft = tree.detach(b->left);
+				GTreeOwner treeRight = tree.detach(b->right);
+				tree.root = 0;
+
+				Node* p = find2<true, true>(b->key, root);
+				GTreeOwner below(pool), above(pool);
+				bool found = false;
+				if (!p){
+					above.root = root;
+					root = 0;
+				}
+				else {
+					splay(p);
+					above = detach(p->right);
+					if (!smaller(p->key, b->key)){
+						below = detach(p->left);
+						pool->destroy(p);
+						root = 0;
+						found = true;
+					}
+					else {
+						below = *this;
+					}
+				}
+
+				size_t replaced = found ? 1 : 0;
+				replaced += below.upsert(treeLeft);
+				replaced += above.upsert(treeRight);
+				attach<true>(b, below);
+				attach<false>(b, above);
+				root = b;
+				return replaced;
+			}
+
+			//splits the tree around the key: below gets the smaller keys, above the greater ones
+			//and the node with the key itself, if there is one, is returned on its own
+			Node* splitAround(const IndexT& key, GTreeOwner& below, GTreeOwner& above){
+				Node* p = find2<true, true>(key, root);
+				if (!p){
+					above = *this;
+					return 0;
+				}
+				splay(p);
+				above = detach(p->right);
+				if (smaller(p->key, key)){
+					below = *this;
+					return 0;
+				}
+				below = detach(p->left);
+				root = 0;
+				return p;
+			}
+
+			//Relinks the nodes into a perfectly balanced tree, O(n). Returns their number.
+			size_t rebalance(){
+				NodeVector nodes(pool->allocator());
+				for (Node* p = minimum(root); p; p = successor(p)) nodes.push_back(p);
+				root = link(nodes.data(), nodes.size(), 0);
+				return nodes.size();
+			}
+
+			//Union, intersection or difference of our keys with those of the other tree, by divide
+			//and conquer over the other tree: ours is split at the key of its root, the halves
+			//are combined with its subtrees and joined again, with that root or our node of the
+			//same key in between if it stays. On keys in both trees the values are added (ours first).
+			//The other tree is left empty. Its depth bounds the recursion, so it should be balanced.
+			//The top parallel levels run their right half as a separate task, the tasks never
+			//touch the pool, the subtrees that get dropped are collected in garbage instead.
+			template<SetOperation operation>
+			void combine(GTreeOwner& tree, int parallel, vector<Node*>& garbage){
+				Node* b = tree.root;
+				if (!b || !root){
+					//one side is empty
+					if (operation == Union){
+						if (!root) root = b;
+					}
+					else {
+						if (b) garbage.push_back(b);
+						if (operation == Intersection && root) garbage.push_back(root);
+						if (operation == Intersection) root = 0;
+					}
+					tree.root = 0;
+					return;
+				}
+				GTreeOwner treeLeft = tree.detach(b->left);
+				GTreeOwner treeRight = tree.detach(b->right);
+				tree.root = 0;
+
+				GTreeOwner below(pool), above(pool);
+				Node* same = splitAround(b->key, below, above);
+				if (parallel > 0){
+					vector<Node*> garbageRight;
+					future<void> right = async(launch::async, [&](){
+						above.template combine<operation>(treeRight, parallel - 1, garbageRight);
+					});
+					below.template combine<operation>(treeLeft, parallel - 1, garbage);
+					right.get();
+					garbage.insert(garbage.end(), garbageRight.begin(), garbageRight.end());
+				}
+				else {
+					below.template combine<operation>(treeLeft, 0, garbage);
+					above.template combine<operation>(treeRight, 0, garbage);
+				}
+
+				Node* middle = 0;
+				if (operation == Union){
+					if (same){
+						b->value = add(same->value, b->value);
+						garbage.push_back(same);
+					}
+					middle = b;
+				}
+				else if (operation == Intersection && same){
+					same->value = add(same->value, b->value);
+					middle = same;
+					garbage.push_back(b);
+				}
+				else {
+					if (same) garbage.push_back(same);
+					garbage.push_back(b);
+				}
+
+				if (middle){
+					root = middle;
+					attach<true>(middle, below);
+					attach<false>(middle, above);
+				}
+				else {
+					below.join(above);
+					*this = below;
+				}
+			}
+
+			//cuts off the nodes below the range and returns them as a separate tree
+			GTreeOwner cutBelow(const Range<IndexT>& range){
+				if (!range.l_type) return GTreeOwner(pool);
+				Node* p = range.l_type == 1 ?
+					find2<true, false>(range.l_val, root) : find2<true, true>(range.l_val, root);
+				if (!p) return GTreeOwner(pool);
+				splay(p);
+				GTreeOwner rest = detach(p->right);
+				GTreeOwner below = *this;
+				*this = rest;
+				return below;
+			}
+
+			//cuts off the nodes above the range and returns them as a separate tree
+			GTreeOwner cutAbove(const Range<IndexT>& range){
+				if (!range.r_type) return GTreeOwner(pool);
+				Node* p = range.r_type == 1 ?
+					find2<false, false>(range.r_val, root) : find2<false, true>(range.r_val, root);
+				if (!p) return GTreeOwner(pool);
+				splay(p);
+				GTreeOwner rest = detach(p->left);
+				GTreeOwner above = *this;
+				*this = rest;
+				return above;
+			}
+
+			//puts back together what cutBelow and cutAbove took apart
+			void rejoin(GTreeOwner& below, GTreeOwner& above){
+				below.join(*this);
+				below.join(above);
+				*this = below;
+			}
+
+			//cuts out the nodes in the range and returns them as a separate tree
+			GTreeOwner cutRange(const Range<IndexT>& range){
+				GTreeOwner below = cutBelow(range);
+				GTreeOwner above = cutAbove(range);
+				GTreeOwner middle = *this;
+				below.join(above);
+				*this = below;
+				return middle;
+			}
+
+			//aggregate of the values in the range, any tells whether there were some
+			ValueT sum(const Range<IndexT>& range, bool& any){
+				GTreeOwner below = cutBelow(range);
+				GTreeOwner above = cutAbove(range);
+				any = root != 0;
+				ValueT result = root ? root->totalValue : ValueT();
+				rejoin(below, above);
+				return result;
+			}
+
+			ValueT sum(const Range<IndexT>& range){
+				bool any;
+				return sum(range, any);
+			}
+
+			//Order statistics, only with OrderStatistics enabled
+
+			//k-th smallest node, counting from 0, or 0 if there are not that many
+			Node* kth(size_t k)const{
+				Node* node = root;
+				while (node){
+					size_t s = sizeOf(node->left);
+					if (k < s) node = node->left;
+					else if (k == s) return node;
+					else {
+						k -= s + 1;
+						node = node->right;
+					}
+				}
+				return 0;
+			}
+
+			//number of keys smaller than (or equal to, if inclusive) the given key
+			//the last node on the search path is accessed
+			template<bool inclusive>
+			size_t countBelow(const IndexT& key){
+				size_t n = 0;
+				Node* node = root;
+				Node* last = 0;
+				while (node){
+					last = node;
+					if (inclusive ? !smaller(key, node->key) : smaller(node->key, key)){
+						n += sizeOf(node->left) + 1;
+						node = node->right;
+					}
+					else node = node->left;
+				}
+				access(last);
+				return n;
+			}
+
 			//Returns true if a new node was created
 			//indices must be unique!
-			bool insert(const IndexT& key, const ValueT& value = ValueT()){
-				Node *z = root;
-				Node *p = 0;
-
+			//The node with the key, or else 0 and the node a new one with that key would hang from.
+			//The search starts at from, whose subtree must be the one the key belongs to.
+			template<class K>
+			Node* locate(const K& key, Node*& parent, Node* from)const{
+				Probe probe(key);
+				Node* z = from;
+				parent = 0;
 				while (z) {
-					p = z;
-					if (smaller(key, z->key)) z = z->left;
-					else
-						if (smaller(z->key, key)) z = z->right;
-						else {
-							z->value = value;
-							return false;
-						}
+					int c = order(key, probe, z);
+					if (c < 0) {
+						parent = z;
+						z = z->left;
+					}
+					else if (c > 0) {
+						parent = z;
+						z = z->right;
+					}
+					else return z;
 				}
+				return 0;
+			}
 
-				z = new Node(key, value);
+			template<class K>
+			Node* locate(const K& key, Node*& parent)const{
+				return locate(key, parent, root);
+			}
+
+			//Climbs from the finger to the lowest ancestor whose subtree the key belongs to,
+			//or to the node with the key if it is met on the way. Only the ancestors that bound
+			//the finger's subtree on the key's side are compared with it.
+			template<class K>
+			Node* climb(const K& key, Node* u)const{
+				Probe probe(key);
+				int c = order(key, probe, u);
+				if (!c) return u;
+				while (u->parent){
+					Node* p = u->parent;
+					if ((u == p->left) == (c > 0)){
+						int d = order(key, probe, p);
+						if (!d) return p;
+						if ((d > 0) != (c > 0)) break;
+					}
+					u = p;
+				}
+				return u;
+			}
+
+			//hangs a node that is in no tree below the parent found by locate and splays it.
+			//The ancestors are left stale, the rotations of the splay repair each of them.
+			void hang(Node* z, Node* p){
+				z->left = z->right = 0;
 				z->parent = p;
 
 				if (!p) root = z;
 				else if (smaller(p->key, z->key)) p->right = z;
 				else p->left = z;
-				repair<true>(z);
+				repair<false>(z);
 				splay(z);
+			}
+
+			//Inserts or overwrites, returns true if the key is new.
+			//With a finger the search climbs from there instead of descending from the root.
+			template<class K, class V>
+			bool insert(K&& key, V&& value, Node* finger = 0){
+				Node* p;
+				Node* z = locate(key, p, finger ? climb(key, finger) : root);
+				if (z) {
+					z->value = forward<V>(value);
+					repair<false>(z); //splaying repairs the rest of the path
+					splay(z);
+					return false;
+				}
+				hang(pool->create(forward<K>(key), forward<V>(value)), p);
 				return true;
 			}
 
-			//Returns true if the node was found and erased
-			bool erase(const IndexT &key){
-				Node* z = find(key, root);
-				if (!z) return false;
+			//Constructs the value from args only if the key is new, returns true if it was
+			template<class K, class... Args>
+			bool tryEmplace(K&& key, Args&&... args){
+				Node* p;
+				Node* z = locate(key, p);
+				if (z) {
+					splay(z);
+					return false;
+				}
+				hang(pool->create(forward<K>(key), forward<Args>(args)...), p);
+				return true;
+			}
 
+			//Takes the node out of the tree without destroying it
+			Node* unlink(Node* z){
 				splay(z);
 				GTreeOwner treeLeft = detach(z->left);
 				GTreeOwner treeRight = detach(z->right);
 
 				treeLeft.join(treeRight);
 
-				delete root;
 				root = 0; //our tree does not own any nodes
-
 				attach<false>(0, treeLeft);
 				//now our tree owns all the nodes it should and no other tree does
-				//root was deleted
+				z->left = z->right = z->parent = 0;
+				return z;
+			}
+
+			//Returns true if the node was found and erased
+			bool erase(const IndexT &key){
+				Node* z = find(key, root);
+				if (!z) return false;
+
+				pool->destroy(unlink(z));
 				return true;
 			}
 
-			GTreeOwner(Node* _root = 0) : root(_root){}
+			GTreeOwner(Pool* _pool = 0, Node* _root = 0) : pool(_pool), root(_root){}
 
-			GTreeOwner(GTreeOwner& other) : root(other.root){
+			GTreeOwner(GTreeOwner& other) : pool(other.pool), root(other.root){
 				other.root = 0;
 			}
 
-			GTreeOwner operator=(GTreeOwner& other){
+			GTreeOwner(GTreeOwner&& other) : pool(other.pool), root(other.root){
+				other.root = 0;
+			}
+
+			GTreeOwner& operator=(GTreeOwner& other){
 				if (this != &other){
 					root = other.root;
 					other.root = 0;
@@ -278,8 +744,17 @@ namespace gtree {
 				return *this;
 			}
 
-			void clear(){
-				Node* p = root, *tmp;
+			GTreeOwner& operator=(GTreeOwner&& other){
+				return *this = other;
+			}
+
+			//Hands every node of the subtree to destroy, children first. Nonrecursive and
+			//without extra memory: children are unlinked on the way down, so a node is
+			//destroyed once it has none left. Returns the number of nodes.
+			template<class Destroy>
+			static size_t destroyAll(Node* p, Destroy destroy){
+				size_t n = 0;
+				Node* tmp;
 				while (p){
 					if (p->left){
 						tmp = p;
@@ -294,17 +769,41 @@ namespace gtree {
 					else {
 						tmp = p;
 						p = p->parent;
-						delete tmp;
+						destroy(tmp);
+						n++;
 					}
 				}
+				return n;
+			}
+
+			//Returns the number of nodes freed
+			size_t clear(){
+				Pool* from = pool;
+				size_t n = destroyAll(root, [from](Node* p){ from->destroy(p); });
+				root = 0;
+				return n;
+			}
+
+			//Drops the whole tree, handing the slabs back to the pool at once.
+			//Only nodes that need their destructors run are visited.
+			//Only to be called on the tree that owns every node of its pool!
+			//Once the pool shares nodes with other pools (see split), the nodes are freed one by one.
+			void release(){
+				if (!pool->exclusive()){
+					clear();
+					return;
+				}
+				if (!is_trivially_destructible<Node>::value) clear();
+				pool->release();
 				root = 0;
 			}
 
 			//Nonrecursive!
-			GTreeOwner clone()const{
-				if (!root) return GTreeOwner();
-				queue<Node*> Qold, Qnew;
-				Node* newRoot = new Node(*root);
+			//The copy is allocated from the given pool
+			GTreeOwner clone(Pool* target)const{
+				if (!root) return GTreeOwner(target);
+				NodeQueue Qold(target->allocator()), Qnew(target->allocator());
+				Node* newRoot = target->create(*root);
 				Qold.push(root);
 				Qnew.push(newRoot);
 				while (!Qold.empty()){
@@ -312,36 +811,72 @@ namespace gtree {
 					Node* q = Qnew.front(); Qnew.pop();
 					Node* t;
 					if (p->left){
-						t = new Node(*(p->left));
+						t = target->create(*(p->left));
 						t->parent = q;
 						q->left = t;
 						Qold.push(p->left);
 						Qnew.push(t);
 					}
 					if (p->right){
-						t = new Node(*(p->right));
+						t = target->create(*(p->right));
 						t->parent = q;
 						q->right = t;
 						Qold.push(p->right);
 						Qnew.push(t);
 					}
 				}
-				return GTreeOwner(newRoot);
+				return GTreeOwner(target, newRoot);
 			}
 
 			~GTreeOwner(){
 				clear();
 			}
 
-		} owner;
+		};
+
+		Pool pool;
+		GTreeOwner owner;
+		Reclaimer* reclaimer; //see reclaimInBackground
+		size_t reclaimStep;   //see reclaimIncrementally
+		IncrementalReclaim<Node> dropped;
+
+		//Gets rid of all nodes the way the reclamation mode says.
+		//A dying tree cannot wait for later writes, so it frees what would have been left for them.
+		void drop(bool dying){
+			if (reclaimer && (owner.root || !dropped.empty())){
+				shared_ptr<Pool> old = allocate_shared<Pool>(pool.allocator(), pool.allocator());
+				old->swap(pool);
+				shared_ptr<IncrementalReclaim<Node>> nodes = make_shared<IncrementalReclaim<Node>>();
+				nodes->swap(dropped);
+				nodes->add(owner.root);
+				owner.root = 0;
+				reclaimer->submit([old, nodes]{
+					return nodes->step(size_t(-1), [&old](Node* p){ old->destroy(p); });
+				});
+			}
+			else if (reclaimStep && !dying){
+				dropped.add(owner.root);
+				owner.root = 0;
+			}
+			else {
+				dropped.step(size_t(-1), [this](Node* p){ pool.destroy(p); });
+				owner.release();
+			}
+		}
+
+		//called by every write before it starts
+		void reclaimSome(){
+			if (!dropped.empty()) dropped.step(reclaimStep ? reclaimStep : size_t(-1), [this](Node* p){ pool.destroy(p); });
+		}
 
 	public:
 
 		class Iterator{
+			friend class GTree;
 			Node* p;
-			GTreeOwner& owner;
+			GTreeOwner* owner;
 		public:
-			Iterator(GTreeOwner& _owner, Node* ptr = 0) : owner(_owner), p(ptr) {}
+			Iterator(GTreeOwner& _owner, Node* ptr = 0) : owner(&_owner), p(ptr) {}
 
 			bool operator==(const Iterator& other)const{
 				return p == other.p;
@@ -351,27 +886,34 @@ namespace gtree {
 				return p != other.p;
 			}
 
-			pair<IndexT, ValueT> operator*()const{
-				return make_pair(p->key, p->value);
+			//References into the node, valid until it is erased
+			pair<const IndexT&, const ValueT&> operator*()const{
+				return pair<const IndexT&, const ValueT&>(p->key, p->value);
 			}
 
-			IndexT key(){
+			const IndexT& key()const{
 				return p->key;
 			}
 
-			ValueT value(){
+			const ValueT& value()const{
 				return p->value;
 			}
 
+			//Overwrites the value in place and repairs the aggregates up to the root, O(depth)
+			template<class V>
+			void setValue(V&& value){
+				p->value = forward<V>(value);
+				owner->template repair<true>(p);
+			}
+
 			bool operator!(){
 				return !p;
 			}
 
 			Iterator& operator++(){
 				if (!p) return *this;
-				owner.splay(p);
-				p = owner.minimum(p->right);
-				owner.splay(p);
+				p = owner->successor(p);
+				owner->access(p);
 				return *this;
 			}
 
@@ -383,15 +925,14 @@ namespace gtree {
 
 			Iterator& operator--(){
 				if (!p) return *this;
-				owner.splay(p);
-				p = owner.maximum(p->left);
-				owner.splay(p);
+				p = owner->predecessor(p);
+				owner->access(p);
 				return *this;
 			}
 
 			Iterator operator--(int){
 				Iterator tmp = *this;
-				++*this;
+				--*this;
 				return tmp;
 			}
 
@@ -400,32 +941,522 @@ namespace gtree {
 			}
 		};
 
-		//Non-const versions do not splay.
+		//Read-only walk over the keys of a range, forward or in reverse.
+		//It steps through the parent links and never splays, so a whole scan is O(n + log n)
+		//and the tree keeps its shape. Valid as long as the tree is not written to.
+		class RangeCursor{
+			friend class GTree;
+			Node* p;
+			Node* last; //the final node in the cursor's direction
+			bool reverse;
 
-		GTree():owner(){}
+			RangeCursor(Node* first, Node* _last, bool _reverse) : p(first), last(_last), reverse(_reverse) {}
+		public:
+			RangeCursor() : p(0), last(0), reverse(false) {}
+
+			pair<const IndexT&, const ValueT&> operator*()const{
+				return pair<const IndexT&, const ValueT&>(p->key, p->value);
+			}
+
+			const IndexT& key()const{
+				return p->key;
+			}
+
+			const ValueT& value()const{
+				return p->value;
+			}
+
+			bool operator!()const{
+				return !p;
+			}
 
-		GTree(const GTree& other) : owner(other.owner.clone()){}
+			operator bool()const{
+				return p != 0;
+			}
 
-		GTree operator=(const GTree& other){
+			//next key in the cursor's direction, out of the range once the last one is passed
+			RangeCursor& operator++(){
+				if (!p) return *this;
+				if (p == last) p = 0;
+				else p = reverse ? GTreeOwner::predecessor(p) : GTreeOwner::successor(p);
+				return *this;
+			}
+
+			RangeCursor operator++(int){
+				RangeCursor tmp = *this;
+				++*this;
+				return tmp;
+			}
+		};
+
+		//Const versions do not splay, non-const reads splay as SplayPolicy says.
+
+		GTree():owner(&pool), reclaimer(0), reclaimStep(0){}
+
+		explicit GTree(const Alloc& alloc) : pool(alloc), owner(&pool), reclaimer(0), reclaimStep(0){}
+
+		//The copy gets the allocator chosen by select_on_container_copy_construction.
+		//The reclamation mode is not copied.
+		GTree(const GTree& other) :
+			pool(allocator_traits<Alloc>::select_on_container_copy_construction(other.pool.allocator())),
+			owner(other.owner.clone(&pool)), reclaimer(0), reclaimStep(0){}
+
+		GTree(const GTree& other, const Alloc& alloc) : pool(alloc), owner(other.owner.clone(&pool)), reclaimer(0), reclaimStep(0){}
+
+		//Builds a balanced tree out of (key, value) pairs in O(n), see GTreeOwner::build
+		template<class InputIt>
+		GTree(InputIt first, InputIt last, const Alloc& alloc = Alloc()) : pool(alloc), owner(&pool), reclaimer(0), reclaimStep(0){
+			owner.build(first, last);
+		}
+
+		//The allocator is not propagated, the copy is made with our own
+		GTree& operator=(const GTree& other){
 			if (this != &other){
-				owner.clear();
-				owner = other.owner.clone();
+				drop(false);
+				GTreeOwner copy = other.owner.clone(&pool);
+				owner = copy;
 			}
 			return *this;
 		}
 
+		//The nodes stay where they are, the pool holding them moves along,
+		//so do the reclamation mode and the nodes still waiting for it
+		GTree(GTree&& other) noexcept : pool(other.pool.allocator()), owner(&pool),
+			reclaimer(other.reclaimer), reclaimStep(other.reclaimStep){
+			pool.swap(other.pool);
+			owner = other.owner;
+			dropped.swap(other.dropped);
+		}
+
+		//If the allocators differ the nodes are copied with our own
+		GTree& operator=(GTree&& other){
+			if (this != &other){
+				drop(false);
+				if (pool.allocator() == other.pool.allocator()){
+					pool.swap(other.pool);
+					dropped.swap(other.dropped); //they live in the pool that went over
+					owner = other.owner;
+				}
+				else {
+					GTreeOwner copy = other.owner.clone(&pool);
+					owner = copy;
+					other.clear();
+				}
+			}
+			return *this;
+		}
+
+		~GTree(){
+			drop(true);
+		}
+
+		//Reclamation modes, both off by default. They decide what happens to the nodes
+		//dropped by clear(), assignments and the destructor.
+
+		//The nodes, along with the slabs they live in, are handed to the reclaimer's thread in O(1),
+		//the tree goes on with an empty pool. The reclaimer reports the progress and must outlive the tree.
+		//0 switches it off.
+		void reclaimInBackground(Reclaimer* _reclaimer){
+			reclaimer = _reclaimer;
+		}
+
+		//Without a reclaimer clear() and assignments only detach the root, every write that follows
+		//(insert, erase and the like) first frees up to that many of the dropped nodes.
+		//The destructor frees whatever is left at once. 0 switches it off.
+		void reclaimIncrementally(size_t nodesPerWrite){
+			reclaimStep = nodesPerWrite;
+		}
+
+		//Whether dropped nodes are still waiting for writes to free them
+		bool reclaiming()const{
+			return !dropped.empty();
+		}
+
+		//Nodes freed so far by incremental reclamation
+		size_t reclaimedNodes()const{
+			return dropped.reclaimed();
+		}
+
+		allocator_type get_allocator()const{
+			return pool.allocator();
+		}
+
+		//Bytes taken by one node, keys and values included (values of type Void take none)
+		static constexpr size_t nodeSize(){
+			return sizeof(Node);
+		}
+
+		//Bytes held by the node pool, including free nodes
+		size_t memoryUsage()const{
+			return pool.memoryUsage();
+		}
+
+		//Gives the free nodes of the pool to the trees it shares nodes with (see splitAt),
+		//whichever of them runs out first reuses them. Does nothing if the pool is not shared.
+		void handOverFreeNodes(){
+			pool.handOver();
+		}
+
+		//Inserts or overwrites, the iterator points to the key
 		pair<Iterator, bool> insert(const IndexT& key, const ValueT& value = ValueT()){
+			reclaimSome();
 			bool ok = owner.insert(key, value);
 			return make_pair(Iterator(owner, owner.root), ok);
 		}
 
+		//Moves the key and the value into the node instead of copying them
+		pair<Iterator, bool> insert(IndexT&& key, ValueT&& value = ValueT()){
+			reclaimSome();
+			bool ok = owner.insert(move(key), move(value));
+			return make_pair(Iterator(owner, owner.root), ok);
+		}
+
+		//Searches from the hint instead of the root: it climbs only as far as needed to reach
+		//the subtree the key belongs to, then descends. For a key d places from the hint this
+		//is O(log d) amortized, e.g. for keys coming almost in order, each hinted with the
+		//iterator returned for the previous one. An iterator of another tree or out of range
+		//is ignored as a hint. Like any iterator, a hint is invalidated by erasing its key, and
+		//so is every iterator taken before splitAt, concat, append, the set operations or swap,
+		//which move nodes between trees: such a hint is not detected and corrupts both trees.
+		pair<Iterator, bool> insert(const Iterator& hint, const IndexT& key, const ValueT& value = ValueT()){
+			reclaimSome();
+			bool ok = owner.insert(key, value, hint.owner == &owner ? hint.p : 0);
+			return make_pair(Iterator(owner, owner.root), ok);
+		}
+
+		pair<Iterator, bool> insert(const Iterator& hint, IndexT&& key, ValueT&& value = ValueT()){
+			reclaimSome();
+			bool ok = owner.insert(move(key), move(value), hint.owner == &owner ? hint.p : 0);
+			return make_pair(Iterator(owner, owner.root), ok);
+		}
+
+		//Inserts the key with a value constructed in place from args, if the key is not there yet.
+		//An existing value is left alone and args are not touched.
+		template<class... Args>
+		pair<Iterator, bool> try_emplace(const IndexT& key, Args&&... args){
+			reclaimSome();
+			bool ok = owner.tryEmplace(key, forward<Args>(args)...);
+			return make_pair(Iterator(owner, owner.root), ok);
+		}
+
+		template<class... Args>
+		pair<Iterator, bool> try_emplace(IndexT&& key, Args&&... args){
+			reclaimSome();
+			bool ok = owner.tryEmplace(move(key), forward<Args>(args)...);
+			return make_pair(Iterator(owner, owner.root), ok);
+		}
+
+		//Like std::map::emplace: args construct a (key, value) pair, which is moved into
+		//a new node unless the key is there already
+		template<class... Args>
+		pair<Iterator, bool> emplace(Args&&... args){
+			pair<IndexT, ValueT> kv(forward<Args>(args)...);
+			return try_emplace(move(kv.first), move(kv.second));
+		}
+
+		//Owns a key and value taken out of a tree by extract, until they are inserted into a tree again.
+		//The node is allocated on its own rather than in the tree's slabs, so the handle stays valid
+		//whatever happens to the tree afterwards, including clear(), assignment and destruction.
+		class NodeHandle{
+			friend class GTree;
+			typedef typename allocator_traits<Alloc>::template rebind_alloc<Node> NodeAlloc;
+			typedef allocator_traits<NodeAlloc> NodeTraits;
+
+			NodeAlloc alloc;
+			Node* node;
+
+			//moves the key and the value out of the given node
+			NodeHandle(Node* from, const Alloc& _alloc) : alloc(_alloc), node(0){
+				Node* p = addressof(*NodeTraits::allocate(alloc, 1));
+				try {
+					NodeTraits::construct(alloc, p, move(from->key), move(from->value));
+				}
+				catch (...) {
+					NodeTraits::deallocate(alloc, p, 1);
+					throw;
+				}
+				node = p;
+			}
+
+			void reset(){
+				if (!node) return;
+				NodeTraits::destroy(alloc, node);
+				NodeTraits::deallocate(alloc, node, 1);
+				node = 0;
+			}
+		public:
+			NodeHandle() : node(0) {}
+
+			NodeHandle(NodeHandle&& other) noexcept : alloc(move(other.alloc)), node(other.node){
+				other.node = 0;
+			}
+
+			NodeHandle& operator=(NodeHandle&& other) noexcept{
+				if (this != &other){
+					reset();
+					alloc = move(other.alloc);
+					node = other.node;
+					other.node = 0;
+				}
+				return *this;
+			}
+
+			~NodeHandle(){
+				reset();
+			}
+
+			bool empty()const{
+				return !node;
+			}
+
+			operator bool()const{
+				return node != 0;
+			}
+
+			//the key may be changed before the node is inserted again
+			IndexT& key()const{
+				return node->key;
+			}
+
+			ValueT& value()const{
+				return node->value;
+			}
+		};
+
+		//Takes the key and its value out of the tree, moving rather than copying them.
+		//The handle is empty if the key is not there.
+		NodeHandle extract(const IndexT& key){
+			reclaimSome();
+			Node* p = owner.find(key, owner.root);
+			if (!p) return NodeHandle();
+			GTreeOwner emptied(&pool, owner.unlink(p)); //frees the node once its contents moved, or if that throws
+			return NodeHandle(p, pool.allocator());
+		}
+
+		//Moves the handle's key and value into a new node of this tree, unless the key is there already,
+		//in which case the handle keeps them and the iterator points to the existing key.
+		pair<Iterator, bool> insert(NodeHandle&& handle){
+			reclaimSome();
+			if (!handle) return make_pair(outOfRange(), false);
+			Node* p;
+			Node* z = owner.locate(handle.node->key, p);
+			if (z) {
+				owner.splay(z);
+				return make_pair(Iterator(owner, z), false);
+			}
+			z = pool.create(move(handle.node->key), move(handle.node->value));
+			handle.reset();
+			owner.hang(z, p);
+			return make_pair(Iterator(owner, z), true);
+		}
+
+		//Aggregate (through Plus) of the values whose keys lie in the range.
+		//The tree is cut around the range and joined again, O(log n) amortized.
+		ValueT sum(const Range<IndexT>& range){
+			return owner.sum(range);
+		}
+
+		//Returns true and sets result to the aggregate if any key lies in the range,
+		//so an empty range can be told apart from one that adds up to ValueT()
+		bool sum(const Range<IndexT>& range, ValueT& result){
+			bool any;
+			ValueT part = owner.sum(range, any);
+			if (any) result = part;
+			return any;
+		}
+
+		//Aggregate of the values with keys up to the given one
+		ValueT sumPrefix(const IndexT& key, bool inclusive = true){
+			return owner.sum(Range<IndexT>(0, key, inclusive ? 1 : 2, key));
+		}
+
+		//Aggregate of the values with keys from the given one on
+		ValueT sumSuffix(const IndexT& key, bool inclusive = true){
+			return owner.sum(Range<IndexT>(inclusive ? 1 : 2, key, 0, key));
+		}
+
+		//Order statistics, only with OrderStatistics enabled
+
+		size_t size()const{
+			static_assert(OrderStatistics, "GTree::size needs OrderStatistics");
+			return owner.sizeOf(owner.root);
+		}
+
+		//Iterator to the k-th smallest key, counting from 0, out of range if there are not that many
+		Iterator kth(size_t k){
+			static_assert(OrderStatistics, "GTree::kth needs OrderStatistics");
+			Node* ptr = owner.kth(k);
+			owner.access(ptr);
+			return Iterator(owner, ptr);
+		}
+
+		//Number of keys smaller than the given one
+		size_t rank(const IndexT& key){
+			static_assert(OrderStatistics, "GTree::rank needs OrderStatistics");
+			return owner.template countBelow<false>(key);
+		}
+
+		//Number of keys in the range
+		size_t countRange(const Range<IndexT>& range){
+			static_assert(OrderStatistics, "GTree::countRange needs OrderStatistics");
+			size_t upTo = range.r_type == 0 ? size() :
+				range.r_type == 1 ? owner.template countBelow<true>(range.r_val) : owner.template countBelow<false>(range.r_val);
+			size_t below = range.l_type == 0 ? 0 :
+				range.l_type == 1 ? owner.template countBelow<false>(range.l_val) : owner.template countBelow<true>(range.l_val);
+			return upTo > below ? upTo - below : 0;
+		}
+
+		//Inserts or overwrites a whole batch of (key, value) pairs at once.
+		//The batch is sorted and built into a balanced tree which is then merged into
+		//this one by splitting and joining, O(k log(n/k)) amortized for k keys.
+		//Of equal keys within the batch the last one wins. Returns the number of new keys.
+		template<class InputIt>
+		size_t insertBatch(InputIt first, InputIt last){
+			reclaimSome();
+			GTreeOwner batch(&pool);
+			size_t k = batch.build(first, last);
+			return k - owner.upsert(batch);
+		}
+
+		size_t insertBatch(const vector<pair<IndexT, ValueT>>& batch){
+			return insertBatch(batch.begin(), batch.end());
+		}
+
 		bool erase(const IndexT& key){
+			reclaimSome();
 			return owner.erase(key);
 		}
 
+		//Removes all keys in the range, returns how many there were and the aggregate of their values.
+		//The range is cut out as one subtree in O(log n) amortized, then its k nodes are freed in O(k).
+		pair<size_t, ValueT> eraseRange(const Range<IndexT>& range){
+			reclaimSome();
+			GTreeOwner gone = owner.cutRange(range);
+			ValueT sum = gone.root ? gone.root->totalValue : ValueT();
+			size_t count = gone.clear();
+			return make_pair(count, sum);
+		}
+
+		//The same, but the nodes are freed on the reclaimer's thread, so the call takes O(log n)
+		//amortized however many keys go. Their slots come back to this tree's pool once
+		//the reclaimer is done with them; destroying the tree waits for that.
+		//The count is read off the subtree sizes, so OrderStatistics is needed.
+		pair<size_t, ValueT> eraseRange(const Range<IndexT>& range, Reclaimer& reclaimer){
+			static_assert(OrderStatistics, "GTree::eraseRange with a Reclaimer needs OrderStatistics");
+			reclaimSome();
+			GTreeOwner gone = owner.cutRange(range);
+			if (!gone.root) return make_pair(size_t(0), ValueT());
+			pair<size_t, ValueT> result(owner.sizeOf(gone.root), gone.root->totalValue);
+			shared_ptr<typename Pool::Retirement> retirement = pool.retire();
+			Node* root = gone.root;
+			gone.root = 0;
+			reclaimer.submit([root, retirement]{
+				return GTreeOwner::destroyAll(root, [&retirement](Node* p){ retirement->destroy(p); });
+			});
+			return result;
+		}
+
+		//Moves the keys from the given one on (or only those above it, if not inclusive)
+		//into a new tree and returns it, O(log n) amortized.
+		//No node is copied, the two trees share their pools from then on (see NodePool::share),
+		//so clearing either of them frees its nodes one by one instead of dropping whole slabs.
+		GTree splitAt(const IndexT& key, bool inclusive = true){
+			GTree above(pool.allocator());
+			pool.share(above.pool);
+			GTreeOwner part = owner.cutAbove(Range<IndexT>(0, key, inclusive ? 2 : 1, key));
+			above.owner = part;
+			return above;
+		}
+
+		GTree split(const IndexT& key){
+			return splitAt(key);
+		}
+
+		//Moves all keys of the other tree, which must be greater than ours, to the end of this one.
+		//O(log n) amortized, the nodes are relinked as they are if the allocators compare equal
+		//and copied otherwise. The other tree is left empty.
+		void concat(GTree& other){
+			if (this == &other) return;
+			if (pool.allocator() == other.pool.allocator()){
+				pool.share(other.pool);
+				owner.join(other.owner);
+			}
+			else {
+				GTreeOwner copy = other.owner.clone(&pool);
+				owner.join(copy);
+				other.clear();
+			}
+		}
+
+		void append(GTree&& other){
+			concat(other);
+		}
+
+	private:
+		template<SetOperation operation>
+		void combine(GTree& other, unsigned threads){
+			if (this == &other) return;
+			GTreeOwner theirs(&pool);
+			if (pool.allocator() == other.pool.allocator()){
+				pool.share(other.pool);
+				theirs = other.owner;
+			}
+			else {
+				GTreeOwner copy = other.owner.clone(&pool);
+				theirs = copy;
+				other.clear();
+			}
+			size_t m = theirs.rebalance();
+			//a task per thread, as long as the parts of the other tree stay big enough to be worth one
+			if (!threads) threads = thread::hardware_concurrency();
+			int parallel = 0;
+			while ((1u << parallel) < threads && (m >> parallel) >= parallelGrain) parallel++;
+			vector<Node*> garbage;
+			owner.template combine<operation>(theirs, parallel, garbage);
+			for (Node* p : garbage) GTreeOwner(&pool, p).clear();
+		}
+
+		static const size_t parallelGrain = 1 << 14;
+
+		static const ValueT& missing(){
+			static const ValueT none = ValueT();
+			return none;
+		}
+
+	public:
+		//Set operations with another tree, whose nodes are relinked into ours (or copied first,
+		//if the allocators differ). The other tree is left empty.
+		//O(m log(n/m + 1)) amortized for m keys in the other tree and n in ours, plus O(m)
+		//to balance the other tree first, so the smaller tree should be the other one.
+		//Independent parts run as std::async tasks, on up to the given number of threads
+		//(0 for one per hardware thread).
+
+		//Adds the keys of the other tree, values of keys in both are added with Plus (ours first)
+		void unionWith(GTree&& other, unsigned threads = 0){
+			combine<Union>(other, threads);
+		}
+
+		//Keeps only the keys that are in the other tree too, their values are added with Plus (ours first)
+		void intersectWith(GTree&& other, unsigned threads = 0){
+			combine<Intersection>(other, threads);
+		}
+
+		//Removes the keys that are in the other tree
+		void differenceWith(GTree&& other, unsigned threads = 0){
+			combine<Difference>(other, threads);
+		}
+
+		//Immutable copy of the current contents for lock-free readers, see GTreeSnapshot.
+		//Does not splay, O(n).
+		Snapshot freeze()const{
+			vector<pair<IndexT, ValueT>, typename allocator_traits<Alloc>::template rebind_alloc<pair<IndexT, ValueT>>> sorted(pool.allocator());
+			for (Node* p = owner.minimum(owner.root); p; p = owner.successor(p)) sorted.push_back(make_pair(p->key, p->value));
+			return Snapshot(sorted.begin(), sorted.end(), pool.allocator());
+		}
+
 		bool exists(const IndexT& key){
 			Node* p = owner.find(key, owner.root);
-			if (p) owner.splay(p);
+			owner.access(p);
 			return p != 0;
 		}
 
@@ -438,20 +1469,21 @@ namespace gtree {
 		}
 
 		void clear(){
-			owner.clear();
+			drop(false);
 		}
 
 		//use only for retrieving values.
-		ValueT operator[](const IndexT& key){
+		//A missing key gives a reference to a shared default-constructed value.
+		const ValueT& operator[](const IndexT& key){
 			Node* p = owner.find(key, owner.root);
-			if (!p) return ValueT();
-			owner.splay(p);
+			if (!p) return missing();
+			owner.access(p);
 			return p->value;
 		}
 
-		ValueT operator[](const IndexT& key)const{
+		const ValueT& operator[](const IndexT& key)const{
 			Node* p = owner.find(key, owner.root);
-			if (!p) return ValueT();
+			if (!p) return missing();
 			return p->value;
 		}
 
@@ -468,34 +1500,141 @@ namespace gtree {
 		Iterator outOfRange(){
 			return Iterator(owner, 0);
 		}
+
+		//Cursor over the keys in the range, from the smallest one on or, if reverse, from the greatest one down
+		RangeCursor cursor(const Range<IndexT>& range, bool reverse = false)const{
+			Node* first = range.l_type == 0 ? owner.minimum(owner.root) :
+				range.l_type == 1 ? owner.find2<false, true>(range.l_val, owner.root) : owner.find2<false, false>(range.l_val, owner.root);
+			Node* last = range.r_type == 0 ? owner.maximum(owner.root) :
+				range.r_type == 1 ? owner.find2<true, true>(range.r_val, owner.root) : owner.find2<true, false>(range.r_val, owner.root);
+			if (!first || !last || owner.smaller(last->key, first->key)) return RangeCursor();
+			return reverse ? RangeCursor(last, first, true) : RangeCursor(first, last, false);
+		}
+
+		//Copies the keys and values of the range, in order, into separate arrays of the caller,
+		//up to cap of them, and returns how many it copied. Either array may be 0 to skip it.
+		//One walk of the cursor, the tree is not touched.
+		size_t exportRange(const Range<IndexT>& range, IndexT* keys, ValueT* values, size_t cap)const{
+			size_t n = 0;
+			for (RangeCursor c = cursor(range); c && n < cap; ++c, n++){
+				if (keys) keys[n] = c.p->key;
+				if (values) values[n] = c.p->value;
+			}
+			return n;
+		}
+
+		//The whole range in chunks: the arrays are filled up to cap and flush(count) is called
+		//each time they are full and once more for the rest, if any.
+		//Returns the total number of keys exported, 0 without calling flush if cap is 0.
+		template<class Flush>
+		size_t exportRange(const Range<IndexT>& range, IndexT* keys, ValueT* values, size_t cap, Flush flush)const{
+			if (!cap) return 0;
+			size_t total = 0, n = 0;
+			for (RangeCursor c = cursor(range); c; ++c){
+				if (keys) keys[n] = c.p->key;
+				if (values) values[n] = c.p->value;
+				if (++n == cap){
+					flush(n);
+					total += n;
+					n = 0;
+				}
+			}
+			if (n) flush(n);
+			return total + n;
+		}
 		
 		Iterator findEqual(const IndexT& key){
 			Node* ptr = owner.find(key, owner.root);
-			owner.splay(ptr);
+			owner.access(ptr);
 			return Iterator(owner, ptr);
 		}
 
 		Iterator findSmallerEqual(const IndexT& key){
 			Node* ptr = owner.find2<true, true>(key, owner.root);
-			owner.splay(ptr);
+			owner.access(ptr);
 			return Iterator(owner, ptr);
 		}
 
 		Iterator findGreaterEqual(const IndexT& key){
 			Node* ptr = owner.find2<false, true>(key, owner.root);
-			owner.splay(ptr);
+			owner.access(ptr);
 			return Iterator(owner, ptr);
 		}
 
 		Iterator findSmaller(const IndexT& key){
 			Node* ptr = owner.find2<true, false>(key, owner.root);
-			owner.splay(ptr);
+			owner.access(ptr);
 			return Iterator(owner, ptr);
 		}
 
 		Iterator findGreater(const IndexT& key){
 			Node* ptr = owner.find2<false, false>(key, owner.root);
-			owner.splay(ptr);
+			owner.access(ptr);
+			return Iterator(owner, ptr);
+		}
+
+		//With a transparent comparator (one defining is_transparent, like less<> or PrefixLess)
+		//lookups also take anything the comparator compares with IndexT, e.g. const char*
+		//or string_view for string keys, without building an IndexT out of it.
+
+		template<class K, class C = Comp, class = typename C::is_transparent>
+		bool exists(const K& key){
+			Node* p = owner.find(key, owner.root);
+			owner.access(p);
+			return p != 0;
+		}
+
+		template<class K, class C = Comp, class = typename C::is_transparent>
+		bool exists(const K& key)const{
+			return owner.find(key, owner.root) != 0;
+		}
+
+		template<class K, class C = Comp, class = typename C::is_transparent>
+		const ValueT& operator[](const K& key){
+			Node* p = owner.find(key, owner.root);
+			if (!p) return missing();
+			owner.access(p);
+			return p->value;
+		}
+
+		template<class K, class C = Comp, class = typename C::is_transparent>
+		const ValueT& operator[](const K& key)const{
+			Node* p = owner.find(key, owner.root);
+			return p ? p->value : missing();
+		}
+
+		template<class K, class C = Comp, class = typename C::is_transparent>
+		Iterator findEqual(const K& key){
+			Node* ptr = owner.find(key, owner.root);
+			owner.access(ptr);
+			return Iterator(owner, ptr);
+		}
+
+		template<class K, class C = Comp, class = typename C::is_transparent>
+		Iterator findSmallerEqual(const K& key){
+			Node* ptr = owner.template find2<true, true>(key, owner.root);
+			owner.access(ptr);
+			return Iterator(owner, ptr);
+		}
+
+		template<class K, class C = Comp, class = typename C::is_transparent>
+		Iterator findGreaterEqual(const K& key){
+			Node* ptr = owner.template find2<false, true>(key, owner.root);
+			owner.access(ptr);
+			return Iterator(owner, ptr);
+		}
+
+		template<class K, class C = Comp, class = typename C::is_transparent>
+		Iterator findSmaller(const K& key){
+			Node* ptr = owner.template find2<true, false>(key, owner.root);
+			owner.access(ptr);
+			return Iterator(owner, ptr);
+		}
+
+		template<class K, class C = Comp, class = typename C::is_transparent>
+		Iterator findGreater(const K& key){
+			Node* ptr = owner.template find2<false, false>(key, owner.root);
+			owner.access(ptr);
 			return Iterator(owner, ptr);
 		}
 
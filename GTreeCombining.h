@@ -0,0 +1,185 @@
+#ifndef _GTREECOMBINING_H
+#define _GTREECOMBINING_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+#include "GTree.h"
+
+using namespace std;
+
+namespace gtree {
+
+	//GTree shared by any number of threads, through flat combining.
+	//A thread publishes its request in one of the slots and whoever holds the combiner lock
+	//applies all published requests in one go, sorted by key so that consecutive splays
+	//stay close to each other. Everyone else waits for its slot to be marked done,
+	//taking over as the combiner if the lock becomes free. The tree itself is only ever
+	//touched by the combiner, so it needs no locking of its own.
+	template<class IndexT, class ValueT = Void, class Comp = less<IndexT>, class Plus = plus<ValueT>,
+		class Alloc = allocator<pair<const IndexT, ValueT>>>
+	class GTreeCombining {
+	public:
+		typedef Alloc allocator_type;
+
+	private:
+		enum State { Free, Writing, Pending, Done };
+		enum Operation { Insert, Erase, Find, Sum };
+
+		//one request, on a cache line of its own so that publishing does not disturb the neighbours
+		struct alignas(64) Slot {
+			atomic<int> state;
+			Operation op;
+			IndexT key;
+			ValueT value;
+			Range<IndexT> range;
+			bool ok;
+
+			Slot() : state(Free), op(Find), key(), value(), range(0, IndexT(), 0, IndexT()), ok(false) {}
+		};
+
+		Comp smaller;
+		GTree<IndexT, ValueT, Comp, Plus, Alloc> tree;
+		size_t slotCount;
+		unique_ptr<Slot[]> slots;
+		mutex combiner;
+		vector<Slot*> batch; //only used by the combiner
+
+		Slot& claim(){
+			size_t i = hash<thread::id>()(this_thread::get_id()) % slotCount;
+			while (1){
+				int expected = Free;
+				if (slots[i].state.compare_exchange_weak(expected, Writing, memory_order_acquire)) return slots[i];
+				if (++i == slotCount){
+					i = 0;
+					this_thread::yield();
+				}
+			}
+		}
+
+		void apply(Slot& s){
+			switch (s.op){
+			case Insert:
+				s.ok = tree.insert(s.key, s.value).second;
+				break;
+			case Erase:
+				s.ok = tree.erase(s.key);
+				break;
+			case Find: {
+				auto it = tree.findEqual(s.key);
+				s.ok = it;
+				if (it) s.value = it.value();
+				break;
+			}
+			case Sum:
+				s.value = tree.sum(s.range);
+				break;
+			}
+		}
+
+		//the combiner lock must be held
+		void combine(){
+			batch.clear();
+			for (size_t i = 0; i < slotCount; i++){
+				if (slots[i].state.load(memory_order_acquire) == Pending) batch.push_back(&slots[i]);
+			}
+			stable_sort(batch.begin(), batch.end(), [this](const Slot* a, const Slot* b){ return smaller(a->key, b->key); });
+			for (Slot* s : batch){
+				apply(*s);
+				s->state.store(Done, memory_order_release);
+			}
+		}
+
+		//publishes the request and returns once it has been applied
+		void run(Slot& s){
+			s.state.store(Pending, memory_order_release);
+			while (s.state.load(memory_order_acquire) != Done){
+				if (combiner.try_lock()){
+					combine();
+					combiner.unlock();
+				}
+				else this_thread::yield();
+			}
+		}
+
+		void finish(Slot& s){
+			s.state.store(Free, memory_order_release);
+		}
+
+	public:
+		//slots limits how many requests can be published at once, more threads just wait for one
+		explicit GTreeCombining(size_t _slots = 64, const Alloc& alloc = Alloc()) :
+			tree(alloc), slotCount(_slots ? _slots : 1), slots(new Slot[slotCount]){
+			batch.reserve(slotCount);
+		}
+
+		GTreeCombining(const GTreeCombining&) = delete;
+		GTreeCombining& operator=(const GTreeCombining&) = delete;
+
+		allocator_type get_allocator()const{
+			return tree.get_allocator();
+		}
+
+		//Returns true if a new key was added
+		bool insert(const IndexT& key, const ValueT& value = ValueT()){
+			Slot& s = claim();
+			s.op = Insert;
+			s.key = key;
+			s.value = value;
+			run(s);
+			bool ok = s.ok;
+			finish(s);
+			return ok;
+		}
+
+		bool erase(const IndexT& key){
+			Slot& s = claim();
+			s.op = Erase;
+			s.key = key;
+			run(s);
+			bool ok = s.ok;
+			finish(s);
+			return ok;
+		}
+
+		//Returns true and sets value if the key is there
+		bool find(const IndexT& key, ValueT& value){
+			Slot& s = claim();
+			s.op = Find;
+			s.key = key;
+			run(s);
+			bool ok = s.ok;
+			if (ok) value = s.value;
+			finish(s);
+			return ok;
+		}
+
+		bool exists(const IndexT& key){
+			ValueT value;
+			return find(key, value);
+		}
+
+		//Aggregate of the values whose keys lie in the range, see GTree::sum
+		ValueT sum(const Range<IndexT>& range){
+			Slot& s = claim();
+			s.op = Sum;
+			s.key = range.l_type ? range.l_val : range.r_val;
+			s.range = range;
+			run(s);
+			ValueT result = s.value;
+			finish(s);
+			return result;
+		}
+
+	};
+}
+
+#endif
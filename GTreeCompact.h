@@ -0,0 +1,427 @@
+#ifndef _GTREECOMPACT_H
+#define _GTREECOMPACT_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+
+using namespace std;
+
+namespace gtree {
+
+	//Same interface as GTree, but the nodes live in one contiguous vector and
+	//link to each other with 32-bit indices instead of pointers.
+	//Index 0 is reserved and plays the role of the null pointer.
+	//At most 2^32 - 2 keys can be stored.
+	template<class IndexT, class ValueT = Void, class Comp = less<IndexT>, class Plus = plus<ValueT>,
+		class Alloc = allocator<pair<const IndexT, ValueT>>>
+	class GTreeCompact {
+	public:
+		typedef Alloc allocator_type;
+
+	private:
+		typedef uint32_t Link;
+		static const Link nil = 0;
+
+		struct Node {
+			Link left;
+			Link right;
+			Link parent;
+			IndexT key;
+			ValueT value, totalValue;
+
+			Node(const IndexT& keyInit, const ValueT& valueInit) :
+				left(nil), right(nil), parent(nil),
+				key(keyInit), value(valueInit), totalValue(valueInit) {}
+
+		};
+
+		typedef vector<Node, typename allocator_traits<Alloc>::template rebind_alloc<Node>> NodeStore;
+
+		Comp smaller;
+		Plus add;
+		NodeStore nodes;
+		Link root;
+		Link freeList; //freed nodes, linked through their left field
+
+		//Rule of thumb: private functions do not splay their results
+
+		Node& at(Link x){
+			return nodes[x];
+		}
+
+		const Node& at(Link x)const{
+			return nodes[x];
+		}
+
+		Link create(const IndexT& key, const ValueT& value){
+			if (freeList){
+				Link x = freeList;
+				freeList = at(x).left;
+				at(x) = Node(key, value);
+				return x;
+			}
+			if (nodes.size() > Link(-2)) throw length_error("GTreeCompact: too many nodes");
+			nodes.push_back(Node(key, value));
+			return Link(nodes.size() - 1);
+		}
+
+		void destroy(Link x){
+			at(x) = Node(IndexT(), ValueT());
+			at(x).left = freeList;
+			freeList = x;
+		}
+
+		void leftRotate(Link x){
+			Link y = at(x).right;
+			if (y){
+				at(x).right = at(y).left;
+				if (at(y).left) at(at(y).left).parent = x;
+				at(y).parent = at(x).parent;
+			}
+			Link p = at(x).parent;
+			if (!p) root = y;
+			else if (x == at(p).left) at(p).left = y;
+			else at(p).right = y;
+			if (y) at(y).left = x;
+			at(x).parent = y;
+			repair<false>(x);
+			repair<false>(y);
+		}
+
+		void rightRotate(Link x){
+			Link y = at(x).left;
+			if (y){
+				at(x).left = at(y).right;
+				if (at(y).right) at(at(y).right).parent = x;
+				at(y).parent = at(x).parent;
+			}
+			Link p = at(x).parent;
+			if (!p) root = y;
+			else if (x == at(p).left) at(p).left = y;
+			else at(p).right = y;
+			if (y) at(y).right = x;
+			at(x).parent = y;
+			repair<false>(x);
+			repair<false>(y);
+		}
+
+		void splay(Link x){
+			if (!x) return;
+			while (Link p = at(x).parent){
+				Link g = at(p).parent;
+				if (!g){
+					if (at(p).left == x) rightRotate(p);
+					else leftRotate(p);
+				}
+				else if (at(p).left == x && at(g).left == p) {
+					rightRotate(g);
+					rightRotate(p);
+				}
+				else if (at(p).right == x && at(g).right == p) {
+					leftRotate(g);
+					leftRotate(p);
+				}
+				else if (at(p).left == x && at(g).right == p) {
+					rightRotate(p);
+					leftRotate(g);
+				}
+				else {
+					leftRotate(p);
+					rightRotate(g);
+				}
+			}
+		}
+
+		Link minimum(Link u)const{
+			if (!u) return nil;
+			while (at(u).left) u = at(u).left;
+			return u;
+		}
+
+		Link maximum(Link u)const{
+			if (!u) return nil;
+			while (at(u).right) u = at(u).right;
+			return u;
+		}
+
+		Link find(const IndexT& key, Link node)const{
+			while (node) {
+				const Node& n = at(node);
+				if (smaller(n.key, key)) node = n.right;
+				else if (smaller(key, n.key)) node = n.left;
+				else {
+					return node;
+				}
+			}
+			return nil;
+		}
+
+		template<bool goLeftOnEqual, bool keepEqual>
+		Link find2(const IndexT& key, Link node)const{
+			Link result = nil;
+			while (node){
+				const Node& n = at(node);
+				if (smaller(n.key, key)){
+					if (goLeftOnEqual) result = node;
+					node = n.right;
+				}
+				else if (smaller(key, n.key)){
+					if (!goLeftOnEqual) result = node;
+					node = n.left;
+				}
+				else {
+					if (keepEqual) return node;
+					node = goLeftOnEqual ? n.left : n.right;
+				}
+			}
+			return result;
+		}
+
+		template<bool propagate>
+		void repair(Link x){
+			if (!x) return;
+			Node& node = at(x);
+			if (!node.left && !node.right){
+				node.totalValue = node.value;
+			}
+			else if (!node.left){
+				node.totalValue = add(node.value, at(node.right).totalValue);
+			}
+			else if (!node.right){
+				node.totalValue = add(at(node.left).totalValue, node.value);
+			}
+			else {
+				node.totalValue = add(add(at(node.left).totalValue, node.value), at(node.right).totalValue);
+			}
+			if (propagate) repair<true>(node.parent);
+		}
+
+		void reset(){
+			nodes.clear();
+			nodes.push_back(Node(IndexT(), ValueT()));
+			root = freeList = nil;
+		}
+
+	public:
+
+		class Iterator{
+			GTreeCompact* tree;
+			Link p;
+		public:
+			Iterator(GTreeCompact& _tree, Link ptr = nil) : tree(&_tree), p(ptr) {}
+
+			bool operator==(const Iterator& other)const{
+				return p == other.p;
+			}
+
+			bool operator!=(const Iterator& other)const{
+				return p != other.p;
+			}
+
+			pair<IndexT, ValueT> operator*()const{
+				return make_pair(tree->at(p).key, tree->at(p).value);
+			}
+
+			IndexT key(){
+				return tree->at(p).key;
+			}
+
+			ValueT value(){
+				return tree->at(p).value;
+			}
+
+			bool operator!(){
+				return !p;
+			}
+
+			Iterator& operator++(){
+				if (!p) return *this;
+				tree->splay(p);
+				p = tree->minimum(tree->at(p).right);
+				tree->splay(p);
+				return *this;
+			}
+
+			Iterator operator++(int){
+				Iterator tmp = *this;
+				++*this;
+				return tmp;
+			}
+
+			Iterator& operator--(){
+				if (!p) return *this;
+				tree->splay(p);
+				p = tree->maximum(tree->at(p).left);
+				tree->splay(p);
+				return *this;
+			}
+
+			Iterator operator--(int){
+				Iterator tmp = *this;
+				--*this;
+				return tmp;
+			}
+
+			operator bool(){
+				return p != nil;
+			}
+		};
+
+		explicit GTreeCompact(const Alloc& alloc = Alloc()) : nodes(alloc), root(nil), freeList(nil){
+			nodes.push_back(Node(IndexT(), ValueT()));
+		}
+
+		GTreeCompact(const GTreeCompact& other) = default;
+
+		GTreeCompact& operator=(const GTreeCompact& other) = default;
+
+		allocator_type get_allocator()const{
+			return nodes.get_allocator();
+		}
+
+		//Reserves room for n keys so that inserting them does not move the store
+		void reserve(size_t n){
+			nodes.reserve(n + 1);
+		}
+
+		//Bytes held by the node store, including unused capacity
+		size_t memoryUsage()const{
+			return nodes.capacity() * sizeof(Node);
+		}
+
+		pair<Iterator, bool> insert(const IndexT& key, const ValueT& value = ValueT()){
+			Link z = root;
+			Link p = nil;
+
+			while (z) {
+				p = z;
+				if (smaller(key, at(z).key)) z = at(z).left;
+				else
+					if (smaller(at(z).key, key)) z = at(z).right;
+					else {
+						at(z).value = value;
+						repair<true>(z);
+						splay(z);
+						return make_pair(Iterator(*this, root), false);
+					}
+			}
+
+			z = create(key, value);
+			at(z).parent = p;
+
+			if (!p) root = z;
+			else if (smaller(at(p).key, key)) at(p).right = z;
+			else at(p).left = z;
+			repair<true>(z);
+			splay(z);
+			return make_pair(Iterator(*this, root), true);
+		}
+
+		bool erase(const IndexT& key){
+			Link z = find(key, root);
+			if (!z) return false;
+
+			splay(z);
+			Link l = at(z).left;
+			Link r = at(z).right;
+			destroy(z);
+
+			if (!l){
+				root = r;
+				if (r) at(r).parent = nil;
+			}
+			else {
+				at(l).parent = nil;
+				root = l;
+				splay(maximum(l));
+				at(root).right = r;
+				if (r) at(r).parent = root;
+				repair<false>(root);
+			}
+			return true;
+		}
+
+		bool exists(const IndexT& key){
+			Link p = find(key, root);
+			if (p) splay(p);
+			return p != nil;
+		}
+
+		bool exists(const IndexT& key)const{
+			return find(key, root) != nil;
+		}
+
+		bool empty()const{
+			return !root;
+		}
+
+		void clear(){
+			reset();
+		}
+
+		//use only for retrieving values.
+		ValueT operator[](const IndexT& key){
+			Link p = find(key, root);
+			if (!p) return ValueT();
+			splay(p);
+			return at(p).value;
+		}
+
+		ValueT operator[](const IndexT& key)const{
+			Link p = find(key, root);
+			if (!p) return ValueT();
+			return at(p).value;
+		}
+
+		Iterator begin(){
+			return Iterator(*this, minimum(root));
+		}
+
+		Iterator end(){
+			return Iterator(*this, maximum(root));
+		}
+
+		Iterator outOfRange(){
+			return Iterator(*this, nil);
+		}
+
+		Iterator findEqual(const IndexT& key){
+			Link ptr = find(key, root);
+			splay(ptr);
+			return Iterator(*this, ptr);
+		}
+
+		Iterator findSmallerEqual(const IndexT& key){
+			Link ptr = find2<true, true>(key, root);
+			splay(ptr);
+			return Iterator(*this, ptr);
+		}
+
+		Iterator findGreaterEqual(const IndexT& key){
+			Link ptr = find2<false, true>(key, root);
+			splay(ptr);
+			return Iterator(*this, ptr);
+		}
+
+		Iterator findSmaller(const IndexT& key){
+			Link ptr = find2<true, false>(key, root);
+			splay(ptr);
+			return Iterator(*this, ptr);
+		}
+
+		Iterator findGreater(const IndexT& key){
+			Link ptr = find2<false, false>(key, root);
+			splay(ptr);
+			return Iterator(*this, ptr);
+		}
+
+	};
+}
+
+#endif
@@ -4,8 +4,14 @@
 #define _GTREELAZY_H
 
 #include "common.h"
+#include "NodePool.h"
+#include "Reclaimer.h"
 
+#include <algorithm>
 #include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
 using namespace std;
 
 namespace gtree {
@@ -19,9 +25,14 @@ namespace gtree {
 		class Adder = _gtree_plus<ValueT, ValueT, CumulativeValueT>,
 		class Updater = _gtree_plus<UpdateT, ValueT, ValueT>,
 		class CumulativeUpdater = _gtree_plus<UpdateT, CumulativeValueT, CumulativeValueT>,
-		class UpdateAdder = _gtree_plus<UpdateT, UpdateT, UpdateT>
+		class UpdateAdder = _gtree_plus<UpdateT, UpdateT, UpdateT>,
+		class Alloc = allocator<pair<const IndexT, ValueT>>,
+		bool OrderStatistics = false
 	>
 	class GTreeLazy {
+	public:
+		typedef Alloc allocator_type;
+
 	private:
 		static UpdateT null_update;
 		static Comp comp;
@@ -30,7 +41,8 @@ namespace gtree {
 		static CumulativeUpdater cumulativeUpdater;
 		static UpdateAdder updateAdder;
 
-		struct Node {
+		// update comes from _gtree_update, which stores nothing for NoUpdate
+		struct Node : _gtree_size<OrderStatistics>, _gtree_update<UpdateT> {
 			Node* left;
 			Node* right;
 			Node* parent;
@@ -38,83 +50,150 @@ namespace gtree {
 			IndexT key;
 			ValueT value;
 			CumulativeValueT cumulativeValue;
-			UpdateT update;
 
 			Node (const IndexT& keyInit, const ValueT& valueInit) :
+				_gtree_update<UpdateT>(null_update),
 				left(nullptr),
 				right(nullptr),
 				parent(nullptr),
 				key(keyInit),
 				value(valueInit),
-				cumulativeValue(valueInit),
-				update(null_update) {}
+				cumulativeValue(valueInit) {}
 		};
 
+		typedef NodePool<Node, Alloc> Pool;
+		typedef vector<Node*, typename allocator_traits<Alloc>::template rebind_alloc<Node*>> NodeVector;
+
+		Pool pool;
 		Node* root;
+		Reclaimer* reclaimer; // see reclaim_in_background
+		size_t reclaim_step; // see reclaim_incrementally
+		IncrementalReclaim<Node> dropped;
 
 	public:
 
-		GTreeLazy(Node* root) : root(root) {}
+		GTreeLazy() : root(nullptr), reclaimer(nullptr), reclaim_step(0) {}
 
-		GTreeLazy() : root(nullptr) {}
+		explicit GTreeLazy(const Alloc& alloc) : pool(alloc), root(nullptr), reclaimer(nullptr), reclaim_step(0) {}
 
-		GTreeLazy(const GTreeLazy& other) : root(other.clone()) {}
+		// the reclamation mode is not copied
+		GTreeLazy(const GTreeLazy& other) :
+			pool(allocator_traits<Alloc>::select_on_container_copy_construction(other.pool.allocator())),
+			root(other.clone(pool)), reclaimer(nullptr), reclaim_step(0) {}
+
+		GTreeLazy(const GTreeLazy& other, const Alloc& alloc) :
+			pool(alloc), root(other.clone(pool)), reclaimer(nullptr), reclaim_step(0) {}
 
 		GTreeLazy& operator= (const GTreeLazy& other) {
 			if (this != &other) {
 				clear();
-				root = other.clone();
+				root = other.clone(pool);
 			}
+			return *this;
 		}
 
-		GTreeLazy(GTreeLazy&& other) : root(other.root) {}
+		// the nodes live in the pool, so it moves along with them,
+		// and so do the reclamation mode and the nodes still waiting for it
+		GTreeLazy(GTreeLazy&& other) noexcept : pool(other.pool.allocator()), root(other.root),
+			reclaimer(other.reclaimer), reclaim_step(other.reclaim_step) {
+			pool.swap(other.pool);
+			dropped.swap(other.dropped);
+			other.root = nullptr;
+		}
 
+		// the allocator is not propagated; if it differs the nodes are copied
 		GTreeLazy& operator= (GTreeLazy&& other) {
+			if (this == &other) return *this;
 			clear();
-			root = other.root;
+			if (pool.allocator() == other.pool.allocator()) {
+				pool.swap(other.pool);
+				dropped.swap(other.dropped); // they live in the pool that went over
+				root = other.root;
+				other.root = nullptr;
+			} else {
+				root = other.clone(pool);
+				other.clear();
+			}
+			return *this;
 		}
 
 		~GTreeLazy() {
-			destroy();
+			drop(true);
+		}
+
+		// Reclamation modes, both off by default, see GTree::reclaimInBackground and
+		// GTree::reclaimIncrementally. They decide what happens to the nodes dropped by
+		// clear(), build(), assignments and the destructor.
+
+		// The nodes go to the reclaimer's thread in O(1) along with the pool, which must outlive the tree.
+		// nullptr switches it off.
+		void reclaim_in_background(Reclaimer* _reclaimer) {
+			reclaimer = _reclaimer;
+		}
+
+		// Without a reclaimer the root is only detached, every set, erase, update_range
+		// and build that follows first frees up to that many of the dropped nodes.
+		// The destructor frees whatever is left at once. 0 switches it off.
+		void reclaim_incrementally(size_t nodes_per_write) {
+			reclaim_step = nodes_per_write;
+		}
+
+		// whether dropped nodes are still waiting for writes to free them
+		bool reclaiming() const {
+			return !dropped.empty();
+		}
+
+		// nodes freed so far by incremental reclamation
+		size_t reclaimed_nodes() const {
+			return dropped.reclaimed();
+		}
+
+		allocator_type get_allocator() const {
+			return pool.allocator();
+		}
+
+		// bytes taken by one node (a NoUpdate update takes none)
+		static constexpr size_t node_size() {
+			return sizeof(Node);
 		}
 
 	private:
-		// may one day get replaced with a call to an allocator
 		void dealloc(Node* node) {
-			delete node;
+			pool.destroy(node);
 		}
 
-		// may one day get replaced with a call to an allocator
 		Node* alloc(const IndexT& keyInit, const ValueT& valueInit) {
-			return new Node(keyInit, valueInit);
+			return pool.create(keyInit, valueInit);
 		}
 
-		Node* alloc(Node* other) {
-			return alloc(other->key, other->value);
+		static size_t size_of(Node* node) {
+			return node ? node->getSize() : 0;
 		}
 
-		// repairs cumulative values
+		// repairs cumulative values (and subtree sizes)
 		template<bool propagate>
 		void repair(Node* node) {
 			if (!node) return;
 			doUpdates(node);
 			doUpdates(node->left);
 			doUpdates(node->right);
+			node->setSize(size_of(node->left) + 1 + size_of(node->right));
 			if (!node->left && !node->right) {
-				node->totalValue = node->value;
+				node->cumulativeValue = node->value;
 			} else if (!node->left) {
-				node->totalValue = adder(node->value, node->right->totalValue);
+				node->cumulativeValue = adder(node->value, node->right->cumulativeValue);
 			} else if (!node->right) {
-				node->totalValue = adder(node->left->totalValue, node->value);
+				node->cumulativeValue = adder(node->left->cumulativeValue, node->value);
 			} else {
-				node->totalValue = adder(adder(node->left->totalValue, node->value), node->right->totalValue);
+				node->cumulativeValue = adder(adder(node->left->cumulativeValue, node->value), node->right->cumulativeValue);
 			}
 			if (propagate) repair<true>(node->parent);
 		}
 
 		// Pushes pending updates. MUST be done before a node is accessed
+		// (there are never any with NoUpdate, so it is a no-op then)
 		void doUpdates(Node* node) {
-			if (!node) return;
+			if (!_gtree_update<UpdateT>::enabled || !node) return;
 			node->value = updater(node->update, node->value);
 			node->cumulativeValue = cumulativeUpdater(node->update, node->cumulativeValue);
 			if (node->left) {
@@ -206,39 +285,6 @@ namespace gtree {
 			splay(p);
 		}
 
-		// Only to be called when there is no node in the tree with index equal to node->index.
-		// Only to be called with newly created nodes.
-		void insert(Node* node) {
-			Node* p = root;
-			if (!p) {
-				root = node;
-				return;
-			}
-			while (1) {
-				doUpdates(p);
-				if (comp(p->index, node->index)) {
-					// go right
-					if (p->right) {
-						p = p->right;
-					} else {
-						p->right = node;
-						break;
-					}
-				} else {
-					// go left
-					if (p->left) {
-						p = p->left;
-					} else {
-						p->left = node;
-						break;
-					}
-				}
-			}
-			node->parent = p;
-			repair<true>(node);
-			splay(node);
-		}
-
 		// The path from the root to the node must be properly updated.
 		void remove(Node* node) {
 			splay(node);
@@ -247,16 +293,14 @@ namespace gtree {
 				doUpdates(node->left);
 				doUpdates(node->right);
 
+				// the left subtree becomes the tree for a moment
 				node->left->parent = nullptr;
-				GTreeLazy tmp(node->left);
-				tmp.splayHighest();
-
-				tmp.root->right = node->right;
-				node->right->parent = tmp.root;
-				repair<false>(tmp.root);
+				root = node->left;
+				splayHighest();
 
-				root = tmp.root;
-				tmp.root = nullptr;
+				root->right = node->right;
+				node->right->parent = root;
+				repair<false>(root);
 			} else if (node->left) {
 				node->left->parent = nullptr;
 				root = node->left;
@@ -277,8 +321,9 @@ namespace gtree {
 			Node* p = root;
 			while (p) {
 				doUpdates(p);
-				if (!comp(p->index, index)) {
+				if (!comp(p->key, index)) {
 					found = p;
+					if (!comp(index, p->key)) break; // an equal one is the bound, nothing smaller can be
 					p = p->left;
 				} else {
 					p = p->right;
@@ -297,7 +342,7 @@ namespace gtree {
 			Node* p = root;
 			while (p) {
 				doUpdates(p);
-				if (!comp(index, p->index)) {
+				if (!comp(index, p->key)) {
 					found = p;
 					p = p->right;
 				} else {
@@ -315,7 +360,7 @@ namespace gtree {
 			Node* p = root->left;
 
 			root->left = nullptr;
-			p->parent = nullptr;
+			if (p) p->parent = nullptr;
 			repair<false>(root);
 
 			return p;
@@ -327,13 +372,14 @@ namespace gtree {
 			Node* p = root->right;
 
 			root->right = nullptr;
-			p->parent = nullptr;
+			if (p) p->parent = nullptr;
 			repair<false>(root);
 
 			return p;
 		}
 
 		void attach_left(Node* node) {
+			if (!node) return;
 			doUpdates(root);
 			doUpdates(node);
 			if (root) {
@@ -347,6 +393,7 @@ namespace gtree {
 		}
 
 		void attach_right(Node* node) {
+			if (!node) return;
 			doUpdates(root);
 			doUpdates(node);
 			if (root) {
@@ -359,7 +406,8 @@ namespace gtree {
 			}
 		}
 
-		void split_tree(Range range, Node*& leftSplit, Node*& rightSplit) {
+		// Cuts off the nodes below and above the range, leaving only the ones inside it in the tree
+		void split_tree(Range<IndexT> range, Node*& leftSplit, Node*& rightSplit) {
 			
 			leftSplit = nullptr;
 			rightSplit = nullptr;
@@ -410,56 +458,54 @@ namespace gtree {
 			attach_left(leftSplit);
 		}
 
+		Node* copy_node(Pool& target, const Node* node, Node* parent) const {
+			Node* copy = target.create(*node);
+			copy->left = nullptr;
+			copy->right = nullptr;
+			copy->parent = parent;
+			return copy;
+		}
+
 		// nonrecursive and O(1) additional memory!
-		Node* clone() {
+		// pending updates are copied as they are, the copy is allocated from the given pool
+		Node* clone(Pool& target) const {
 			if (!root) return nullptr;
 
-			Node* activeOld = root;
-			doUpdates(root);
-			int state = 0; // 0 - came from above, 1 - came from left, 2 - came from right
-			Node* activeNew = alloc(root);
-			while (activeOld) {
-				doUpdates(activeOld);
-				if (state == 0) {
-					// try to go left
-					if (activeOld->left) {
-						activeNew->left = alloc(activeOld);
-						activeOld = activeOld->left;
-						activeNew->left->parent = activeNew;
-						activeNew = activeNew->left;
-						state = 0;
-					} else {
-						// activeNew->left = nullptr;
-						state = 1;
-					}
-				} else if (state == 1) {
-					// try to go right
-					if (activeOld->right) {
-						activeNew->right = alloc(activeOld);
-						activeOld = activeOld->right;
-						activeNew->right->parent = activeNew;
-						activeNew = activeNew->right;
-						state = 0;
-					} else {
-						// activeNew->right = nullptr;
-						state = 2;
-					}
-				} else {
-					// go up but only if this is not the root
+			const Node* activeOld = root;
+			Node* activeNew = copy_node(target, root, nullptr);
+			while (1) {
+				// a child that is missing in the copy has not been visited yet
+				if (activeOld->left && !activeNew->left) {
+					activeNew->left = copy_node(target, activeOld->left, activeNew);
+					activeOld = activeOld->left;
+					activeNew = activeNew->left;
+				} else if (activeOld->right && !activeNew->right) {
+					activeNew->right = copy_node(target, activeOld->right, activeNew);
+					activeOld = activeOld->right;
+					activeNew = activeNew->right;
+				} else if (activeOld != root) {
 					activeOld = activeOld->parent;
-					if (activeNew->parent) {
-						if (activeNew->parent->left == activeNew) {
-							state = 1;
-						} else {
-							state = 2;
-						}
-						activeNew = activeNew->parent;
-					}
+					activeNew = activeNew->parent;
+				} else {
+					break;
 				}
 			}
 			return activeNew;
 		}
 
+		// links the n nodes, sorted by index, into a perfectly balanced tree
+		// cumulative values are computed bottom-up on the way
+		Node* link(Node** nodes, size_t n, Node* parent) {
+			if (!n) return nullptr;
+			size_t mid = n / 2;
+			Node* node = nodes[mid];
+			node->parent = parent;
+			node->left = link(nodes, mid, node);
+			node->right = link(nodes + mid + 1, n - mid - 1, node);
+			repair<false>(node);
+			return node;
+		}
+
 		bool equals(IndexT a, IndexT b) {
 			return !comp(a, b) && !comp(b, a);
 		}
@@ -468,66 +514,204 @@ namespace gtree {
 
 		// Some predefined ranges
 
-		Range all() {
+		Range<IndexT> all() {
 			return Range<IndexT>(0, IndexT(), 0, IndexT());
 		}
 
-		Range single(IndexT value) {
+		Range<IndexT> single(IndexT value) {
 			return Range<IndexT>(1, value, 1, value);
 		}
 
-		Range strictly_less(IndexT value) {
+		Range<IndexT> strictly_less(IndexT value) {
 			return Range<IndexT>(0, IndexT(), 2, value);
 		}
 
-		Range less_or_equal(IndexT value) {
+		Range<IndexT> less_or_equal(IndexT value) {
 			return Range<IndexT>(0, IndexT(), 1, value);
 		}
 
-		Range strictly_greater(IndexT value) {
+		Range<IndexT> strictly_greater(IndexT value) {
 			return Range<IndexT>(2, value, 0, IndexT());
 		}
 
-		Range greater_or_equal(IndexT value) {
+		Range<IndexT> greater_or_equal(IndexT value) {
 			return Range<IndexT>(1, value, 0, IndexT());
 		}
 
-		Range range_inclusive(IndexT lower, IndexT upper) {
+		Range<IndexT> range_inclusive(IndexT lower, IndexT upper) {
 			return Range<IndexT>(1, lower, 1, upper);
 		}
 
-		Range range_exclusive(IndexT lower, IndexT upper) {
+		Range<IndexT> range_exclusive(IndexT lower, IndexT upper) {
 			return Range<IndexT>(2, lower, 2, upper);
 		}
 
-		Range range_mixed(IndexT lower, IndexT upper) {
+		Range<IndexT> range_mixed(IndexT lower, IndexT upper) {
 			return Range<IndexT>(1, lower, 2, upper);
 		}
 
+		bool empty() const {
+			return !root;
+		}
+
 		bool has(IndexT index) {
-			lower_bound(index);
-			return equals(index, root->index);
+			return lower_bound(index) && equals(index, root->key);
 		}
 
 		ValueT get(IndexT index) {
 			if (has(index)) {
-				return root.value;
+				return root->value;
 			} else {
 				return ValueT();
 			}
 		}
 
 		void set(IndexT index, ValueT value) {
-			if (has(index)) {
-				root.value = value;
+			reclaim_some();
+			bool found = lower_bound(index);
+			if (found && equals(index, root->key)) {
+				root->value = value;
 				repair<false>(root);
+				return;
+			}
+			// the lookup left the next greater index at the root (if any),
+			// so the new node goes on top of it and what is below, in O(1)
+			Node* node = alloc(index, value);
+			Node* above = found ? root : nullptr;
+			Node* below = found ? detach_left() : root;
+			root = node;
+			attach_left(below);
+			attach_right(above);
+		}
+
+		// Returns true if the index was found and erased
+		bool erase(IndexT index) {
+			reclaim_some();
+			if (!has(index)) return false;
+			remove(root);
+			return true;
+		}
+
+		// Order statistics, only with OrderStatistics enabled
+
+		size_t size() const {
+			static_assert(OrderStatistics, "GTreeLazy::size needs OrderStatistics");
+			return size_of(root);
+		}
+
+		// Returns the k-th smallest index, counting from 0, or IndexT() if there are not that many
+		IndexT kth(size_t k) {
+			static_assert(OrderStatistics, "GTreeLazy::kth needs OrderStatistics");
+			if (k >= size_of(root)) return IndexT();
+			Node* p = root;
+			while (1) {
+				doUpdates(p);
+				size_t s = size_of(p->left);
+				if (k < s) {
+					p = p->left;
+				} else if (k == s) {
+					break;
+				} else {
+					k -= s + 1;
+					p = p->right;
+				}
+			}
+			splay(p);
+			return p->key;
+		}
+
+		// Returns the number of indices smaller than the given one
+		size_t rank(IndexT index) {
+			static_assert(OrderStatistics, "GTreeLazy::rank needs OrderStatistics");
+			size_t n = 0;
+			Node* last = nullptr;
+			Node* p = root;
+			while (p) {
+				doUpdates(p);
+				last = p;
+				if (comp(p->key, index)) {
+					n += size_of(p->left) + 1;
+					p = p->right;
+				} else {
+					p = p->left;
+				}
+			}
+			splay(last);
+			return n;
+		}
+
+		// Returns the number of indices in the range
+		size_t count_range(Range<IndexT> range) {
+			static_assert(OrderStatistics, "GTreeLazy::count_range needs OrderStatistics");
+			Node* left;
+			Node* right;
+			split_tree(range, left, right);
+			size_t n = size_of(root);
+			rejoin_tree(left, right);
+			return n;
+		}
+
+		// Replaces the contents with the (index, value) pairs from the range.
+		// O(n) if they are sorted by index, otherwise they get stable sorted first.
+		// Of equal indices the last one wins, just like with set.
+		template<class InputIt>
+		void build(InputIt first, InputIt last) {
+			clear();
+			reclaim_some();
+			NodeVector nodes(pool.allocator());
+			try {
+				for (; first != last; ++first) {
+					nodes.push_back(alloc(first->first, first->second));
+				}
+			} catch (...) {
+				for (Node* node : nodes) dealloc(node);
+				throw;
+			}
+			auto byIndex = [](const Node* a, const Node* b) { return comp(a->key, b->key); };
+			if (!is_sorted(nodes.begin(), nodes.end(), byIndex)) {
+				stable_sort(nodes.begin(), nodes.end(), byIndex);
+			}
+			size_t n = 0;
+			for (size_t i = 0; i < nodes.size(); i++) {
+				if (i + 1 < nodes.size() && !byIndex(nodes[i], nodes[i + 1])) {
+					dealloc(nodes[i]);
+				} else {
+					nodes[n++] = nodes[i];
+				}
+			}
+			root = link(nodes.data(), n, nullptr);
+		}
+
+		// Moves the indices from the given one on (or only those above it, if not inclusive)
+		// into a new tree and returns it, in O(log n) amortized. The nodes are not copied,
+		// pending updates go along with them. The two trees share their pools from then on.
+		GTreeLazy split_at(IndexT index, bool inclusive = true) {
+			Node* left;
+			Node* right;
+			split_tree(inclusive ? strictly_less(index) : less_or_equal(index), left, right);
+			GTreeLazy above(pool.allocator());
+			pool.share(above.pool);
+			above.root = right;
+			return above;
+		}
+
+		// Moves all indices of the other tree, which must be greater than ours, to the end of this one.
+		// O(log n) amortized, the nodes are copied only if the allocators differ.
+		void append(GTreeLazy&& other) {
+			if (this == &other) return;
+			if (pool.allocator() == other.pool.allocator()) {
+				pool.share(other.pool);
+				attach_right(other.root);
+				other.root = nullptr;
 			} else {
-				Node* p = alloc(index, value);
-				insert(p);
+				attach_right(other.clone(pool));
+				other.clear();
 			}
 		}
 
-		void update_range(Range range, UpdateT update) {
+		// Applies the update to every value in the range, lazily, in O(log n) amortized
+		void update_range(Range<IndexT> range, UpdateT update) {
+			reclaim_some();
 			Node* left;
 			Node* right;
 			split_tree(range, left, right);
@@ -537,40 +721,79 @@ namespace gtree {
 			rejoin_tree(left, right);
 		}
 
-		CumulativeValueT cumulative_value_range(Range range) {
+		// Returns the cumulative value of the range, or CumulativeValueT() if it is empty
+		CumulativeValueT cumulative_value_range(Range<IndexT> range) {
 			Node* left;
 			Node* right;
 			split_tree(range, left, right);
-			CumulativeValueT ret;
+			CumulativeValueT ret = CumulativeValueT();
 			if (root) {
 				doUpdates(root);
 				ret = root->cumulativeValue;
 			}
 			rejoin_tree(left, right);
+			return ret;
 		}
 		
+		// see the reclamation modes above
 		void clear() {
+			drop(false);
+		}
+
+	private:
+		// gets rid of all nodes the way the reclamation mode says;
+		// a dying tree cannot wait for later writes, so it frees what would have been left for them
+		void drop(bool dying) {
+			if (reclaimer && (root || !dropped.empty())) {
+				shared_ptr<Pool> old = allocate_shared<Pool>(pool.allocator(), pool.allocator());
+				old->swap(pool);
+				shared_ptr<IncrementalReclaim<Node>> nodes = make_shared<IncrementalReclaim<Node>>();
+				nodes->swap(dropped);
+				nodes->add(root);
+				root = nullptr;
+				reclaimer->submit([old, nodes] {
+					return nodes->step(size_t(-1), [&old](Node* node) { old->destroy(node); });
+				});
+			} else if (reclaim_step && !dying) {
+				dropped.add(root);
+				root = nullptr;
+			} else {
+				dropped.step(size_t(-1), [this](Node* node) { dealloc(node); });
+				free_all();
+			}
+		}
+
+		// called by every write before it starts
+		void reclaim_some() {
+			if (!dropped.empty()) {
+				dropped.step(reclaim_step ? reclaim_step : size_t(-1), [this](Node* node) { dealloc(node); });
+			}
+		}
+
+		void free_all() {
 			if (!root) return;
 
-			int state = 0; // 0 - came from above, 1 - came from left, 2 - came from right
+			// the slabs go back at once, nodes are only visited if they need destructors
+			// (or if they may live in the slabs of another tree, after split_at or append)
+			if (is_trivially_destructible<Node>::value && pool.exclusive()) {
+				pool.release();
+				root = nullptr;
+				return;
+			}
+
+			// children are unlinked on the way down, so a node without any is done
 			Node* active = root;
 			Node* temp;
 
 			while (active) {
-				if (state == 0) {
-					if (active->left) {
-						active = active->left;
-						state = 0;
-					} else {
-						state = 1;
-					}
-				} else if (state == 1) {
-					if (active->right) {
-						active = active->right;
-						state = 0;
-					} else {
-						state = 2;
-					}
+				if (active->left) {
+					temp = active->left;
+					active->left = nullptr;
+					active = temp;
+				} else if (active->right) {
+					temp = active->right;
+					active->right = nullptr;
+					active = temp;
 				} else {
 					temp = active->parent;
 					dealloc(active);
@@ -578,104 +801,117 @@ namespace gtree {
 				}
 			}
 
+			if (pool.exclusive()) pool.release();
 			root = nullptr;
 		}
 	};
 
 	template<
 		class IndexT,
-		class ValueT = Void,
-		class CumulativeValueT = ValueT,
-		class UpdateT = NoUpdate<ValueT, CumulativeValueT>,
-		class Comp = less<IndexT>,
-		class Adder = _gtree_plus<ValueT, ValueT, CumulativeValueT>,
-		class Updater = _gtree_plus<UpdateT, ValueT, ValueT>,
-		class CumulativeUpdater = _gtree_plus<UpdateT, CumulativeValueT, CumulativeValueT>,
-		class UpdateAdder = _gtree_plus<UpdateT, UpdateT, UpdateT>
+		class ValueT,
+		class CumulativeValueT,
+		class UpdateT,
+		class Comp,
+		class Adder,
+		class Updater,
+		class CumulativeUpdater,
+		class UpdateAdder,
+		class Alloc,
+		bool OrderStatistics
 	>
 	UpdateT GTreeLazy <
 		IndexT, ValueT, CumulativeValueT, UpdateT,
-		Comp, Adder, Updater, CumulativeUpdater, UpdateAdder
+		Comp, Adder, Updater, CumulativeUpdater, UpdateAdder, Alloc, OrderStatistics
 	> :: null_update;
 
 	template<
 		class IndexT,
-		class ValueT = Void,
-		class CumulativeValueT = ValueT,
-		class UpdateT = NoUpdate<ValueT, CumulativeValueT>,
-		class Comp = less<IndexT>,
-		class Adder = _gtree_plus<ValueT, ValueT, CumulativeValueT>,
-		class Updater = _gtree_plus<UpdateT, ValueT, ValueT>,
-		class CumulativeUpdater = _gtree_plus<UpdateT, CumulativeValueT, CumulativeValueT>,
-		class UpdateAdder = _gtree_plus<UpdateT, UpdateT, UpdateT>
+		class ValueT,
+		class CumulativeValueT,
+		class UpdateT,
+		class Comp,
+		class Adder,
+		class Updater,
+		class CumulativeUpdater,
+		class UpdateAdder,
+		class Alloc,
+		bool OrderStatistics
 	>
 	Comp GTreeLazy <
 		IndexT, ValueT, CumulativeValueT, UpdateT,
-		Comp, Adder, Updater, CumulativeUpdater, UpdateAdder
+		Comp, Adder, Updater, CumulativeUpdater, UpdateAdder, Alloc, OrderStatistics
 	> :: comp;
 
 	template<
 		class IndexT,
-		class ValueT = Void,
-		class CumulativeValueT = ValueT,
-		class UpdateT = NoUpdate<ValueT, CumulativeValueT>,
-		class Comp = less<IndexT>,
-		class Adder = _gtree_plus<ValueT, ValueT, CumulativeValueT>,
-		class Updater = _gtree_plus<UpdateT, ValueT, ValueT>,
-		class CumulativeUpdater = _gtree_plus<UpdateT, CumulativeValueT, CumulativeValueT>,
-		class UpdateAdder = _gtree_plus<UpdateT, UpdateT, UpdateT>
+		class ValueT,
+		class CumulativeValueT,
+		class UpdateT,
+		class Comp,
+		class Adder,
+		class Updater,
+		class CumulativeUpdater,
+		class UpdateAdder,
+		class Alloc,
+		bool OrderStatistics
 	>
 	Adder GTreeLazy <
 		IndexT, ValueT, CumulativeValueT, UpdateT,
-		Comp, Adder, Updater, CumulativeUpdater, UpdateAdder
+		Comp, Adder, Updater, CumulativeUpdater, UpdateAdder, Alloc, OrderStatistics
 	> :: adder;
 
 	template<
 		class IndexT,
-		class ValueT = Void,
-		class CumulativeValueT = ValueT,
-		class UpdateT = NoUpdate<ValueT, CumulativeValueT>,
-		class Comp = less<IndexT>,
-		class Adder = _gtree_plus<ValueT, ValueT, CumulativeValueT>,
-		class Updater = _gtree_plus<UpdateT, ValueT, ValueT>,
-		class CumulativeUpdater = _gtree_plus<UpdateT, CumulativeValueT, CumulativeValueT>,
-		class UpdateAdder = _gtree_plus<UpdateT, UpdateT, UpdateT>
+		class ValueT,
+		class CumulativeValueT,
+		class UpdateT,
+		class Comp,
+		class Adder,
+		class Updater,
+		class CumulativeUpdater,
+		class UpdateAdder,
+		class Alloc,
+		bool OrderStatistics
 	>
 	Updater GTreeLazy <
 		IndexT, ValueT, CumulativeValueT, UpdateT,
-		Comp, Adder, Updater, CumulativeUpdater, UpdateAdder
+		Comp, Adder, Updater, CumulativeUpdater, UpdateAdder, Alloc, OrderStatistics
 	> :: updater;
 
 	template<
 		class IndexT,
-		class ValueT = Void,
-		class CumulativeValueT = ValueT,
-		class UpdateT = NoUpdate<ValueT, CumulativeValueT>,
-		class Comp = less<IndexT>,
-		class Adder = _gtree_plus<ValueT, ValueT, CumulativeValueT>,
-		class Updater = _gtree_plus<UpdateT, ValueT, ValueT>,
-		class CumulativeUpdater = _gtree_plus<UpdateT, CumulativeValueT, CumulativeValueT>,
-		class UpdateAdder = _gtree_plus<UpdateT, UpdateT, UpdateT>
+		class ValueT,
+		class CumulativeValueT,
+		class UpdateT,
+		class Comp,
+		class Adder,
+		class Updater,
+		class CumulativeUpdater,
+		class UpdateAdder,
+		class Alloc,
+		bool OrderStatistics
 	>
 	CumulativeUpdater GTreeLazy <
 		IndexT, ValueT, CumulativeValueT, UpdateT,
-		Comp, Adder, Updater, CumulativeUpdater, UpdateAdder
+		Comp, Adder, Updater, CumulativeUpdater, UpdateAdder, Alloc, OrderStatistics
 	> :: cumulativeUpdater;
 
 	template<
 		class IndexT,
-		class ValueT = Void,
-		class CumulativeValueT = ValueT,
-		class UpdateT = NoUpdate<ValueT, CumulativeValueT>,
-		class Comp = less<IndexT>,
-		class Adder = _gtree_plus<ValueT, ValueT, CumulativeValueT>,
-		class Updater = _gtree_plus<UpdateT, ValueT, ValueT>,
-		class CumulativeUpdater = _gtree_plus<UpdateT, CumulativeValueT, CumulativeValueT>,
-		class UpdateAdder = _gtree_plus<UpdateT, UpdateT, UpdateT>
+		class ValueT,
+		class CumulativeValueT,
+		class UpdateT,
+		class Comp,
+		class Adder,
+		class Updater,
+		class CumulativeUpdater,
+		class UpdateAdder,
+		class Alloc,
+		bool OrderStatistics
 	>
 	UpdateAdder GTreeLazy <
 		IndexT, ValueT, CumulativeValueT, UpdateT,
-		Comp, Adder, Updater, CumulativeUpdater, UpdateAdder
+		Comp, Adder, Updater, CumulativeUpdater, UpdateAdder, Alloc, OrderStatistics
 	> :: updateAdder;
 }
 
@@ -0,0 +1,456 @@
+#ifndef _GTREEPERSISTENT_H
+#define _GTREEPERSISTENT_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+
+using namespace std;
+
+namespace gtree {
+
+	//Persistent ordered map: copying it is O(1) and the copy is a snapshot that never changes.
+	//Nodes are shared between versions and reference counted. An update copies only the path
+	//from the root to the nodes it changes, nodes that no other version can see are changed in place.
+	//A node is freed when the last version referencing it is gone.
+	//Reads do not splay (that would need copying too), the shape is kept balanced as a treap
+	//with random priorities instead, using the usual rotations and repairs.
+	//Versions can be read and dropped on any thread, a single version must not be
+	//written to while it is being read or copied.
+	template<class IndexT, class ValueT = Void, class Comp = less<IndexT>, class Plus = plus<ValueT>,
+		class Alloc = allocator<pair<const IndexT, ValueT>>>
+	class GTreePersistent {
+	public:
+		typedef Alloc allocator_type;
+
+	private:
+		struct Node {
+			atomic<size_t> refs;
+			Node* left;
+			Node* right;
+			unsigned priority;
+			IndexT key;
+			ValueT value, totalValue;
+
+			Node(const IndexT& keyInit, const ValueT& valueInit, unsigned priorityInit) :
+				refs(1), left(0), right(0), priority(priorityInit),
+				key(keyInit), value(valueInit), totalValue(valueInit) {}
+
+			//the copy shares the children, so they gain a reference
+			Node(const Node& other) :
+				refs(1), left(other.left), right(other.right), priority(other.priority),
+				key(other.key), value(other.value), totalValue(other.totalValue) {
+				if (left) left->refs.fetch_add(1, memory_order_relaxed);
+				if (right) right->refs.fetch_add(1, memory_order_relaxed);
+			}
+		};
+
+		typedef typename allocator_traits<Alloc>::template rebind_alloc<Node> NodeAlloc;
+		typedef allocator_traits<NodeAlloc> NodeTraits;
+		typedef vector<Node*, typename allocator_traits<Alloc>::template rebind_alloc<Node*>> NodeVector;
+
+		Comp smaller;
+		Plus add;
+		NodeAlloc alloc;
+		unsigned seed;
+		Node* root;
+
+		//Rule of thumb: functions taking a subtree and returning one consume the reference
+		//they were given and hand back a reference owned by the caller
+
+		template<class... Args>
+		Node* create(Args&&... args){
+			Node* node = addressof(*NodeTraits::allocate(alloc, 1));
+			try {
+				NodeTraits::construct(alloc, node, forward<Args>(args)...);
+			}
+			catch (...) {
+				NodeTraits::deallocate(alloc, node, 1);
+				throw;
+			}
+			return node;
+		}
+
+		void destroy(Node* node){
+			NodeTraits::destroy(alloc, node);
+			NodeTraits::deallocate(alloc, node, 1);
+		}
+
+		//Drops one reference, freeing whatever is no longer referenced. Nonrecursive!
+		void release(Node* u){
+			NodeVector stack(alloc);
+			while (1){
+				if (u && u->refs.fetch_sub(1, memory_order_acq_rel) == 1){
+					if (u->left) stack.push_back(u->left);
+					if (u->right) stack.push_back(u->right);
+					destroy(u);
+				}
+				if (stack.empty()) break;
+				u = stack.back();
+				stack.pop_back();
+			}
+		}
+
+		static Node* share(Node* u){
+			if (u) u->refs.fetch_add(1, memory_order_relaxed);
+			return u;
+		}
+
+		//a node that only we can see, either the given one or a copy of it
+		Node* own(Node* u){
+			if (u->refs.load(memory_order_acquire) == 1) return u;
+			Node* copy = create(*u);
+			release(u);
+			return copy;
+		}
+
+		unsigned nextPriority(){
+			//xorshift32
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			return seed;
+		}
+
+		void repair(Node* node){
+			if (!node->left && !node->right){
+				node->totalValue = node->value;
+			}
+			else if (!node->left){
+				node->totalValue = add(node->value, node->right->totalValue);
+			}
+			else if (!node->right){
+				node->totalValue = add(node->left->totalValue, node->value);
+			}
+			else {
+				node->totalValue = add(add(node->left->totalValue, node->value), node->right->totalValue);
+			}
+		}
+
+		//both nodes must be owned
+		Node* leftRotate(Node* x){
+			Node* y = x->right;
+			x->right = y->left;
+			y->left = x;
+			repair(x);
+			repair(y);
+			return y;
+		}
+
+		Node* rightRotate(Node* x){
+			Node* y = x->left;
+			x->left = y->right;
+			y->right = x;
+			repair(x);
+			repair(y);
+			return y;
+		}
+
+		//returns true if a new node was created
+		Node* insert(Node* u, const IndexT& key, const ValueT& value, bool& created){
+			if (!u){
+				created = true;
+				return create(key, value, nextPriority());
+			}
+			u = own(u);
+			if (smaller(key, u->key)){
+				u->left = insert(u->left, key, value, created);
+				if (u->left->priority > u->priority) return rightRotate(u);
+			}
+			else if (smaller(u->key, key)){
+				u->right = insert(u->right, key, value, created);
+				if (u->right->priority > u->priority) return leftRotate(u);
+			}
+			else {
+				u->value = value;
+			}
+			repair(u);
+			return u;
+		}
+
+		//all keys of a are smaller than those of b
+		Node* merge(Node* a, Node* b){
+			if (!a) return b;
+			if (!b) return a;
+			if (a->priority > b->priority){
+				a = own(a);
+				a->right = merge(a->right, b);
+				repair(a);
+				return a;
+			}
+			b = own(b);
+			b->left = merge(a, b->left);
+			repair(b);
+			return b;
+		}
+
+		//the key must be in the subtree
+		Node* erase(Node* u, const IndexT& key){
+			u = own(u);
+			if (smaller(key, u->key)){
+				u->left = erase(u->left, key);
+			}
+			else if (smaller(u->key, key)){
+				u->right = erase(u->right, key);
+			}
+			else {
+				Node* merged = merge(u->left, u->right);
+				u->left = u->right = 0;
+				destroy(u);
+				return merged;
+			}
+			repair(u);
+			return u;
+		}
+
+		const Node* find(const IndexT& key)const{
+			const Node* node = root;
+			while (node){
+				if (smaller(node->key, key)) node = node->right;
+				else if (smaller(key, node->key)) node = node->left;
+				else return node;
+			}
+			return 0;
+		}
+
+		//aggregate of the subtree's values within the range, if any
+		//unbounded sides are skipped, so only the two boundary paths are walked
+		void sum(const Node* u, const Range<IndexT>& range, bool lowerFree, bool upperFree, ValueT& result, bool& any)const{
+			while (u){
+				bool aboveLower = lowerFree || range.l_type == 0 ||
+					(range.l_type == 1 ? !smaller(u->key, range.l_val) : smaller(range.l_val, u->key));
+				bool belowUpper = upperFree || range.r_type == 0 ||
+					(range.r_type == 1 ? !smaller(range.r_val, u->key) : smaller(u->key, range.r_val));
+				if (!aboveLower){
+					u = u->right;
+				}
+				else if (!belowUpper){
+					u = u->left;
+				}
+				else if ((lowerFree || range.l_type == 0) && (upperFree || range.r_type == 0)){
+					result = any ? add(result, u->totalValue) : u->totalValue;
+					any = true;
+					return;
+				}
+				else {
+					sum(u->left, range, lowerFree, true, result, any);
+					result = any ? add(result, u->value) : u->value;
+					any = true;
+					lowerFree = true;
+					u = u->right;
+				}
+			}
+		}
+
+	public:
+
+		//Walks one version in order, keeping the path from the root.
+		//Must not outlive the version it was taken from.
+		class Iterator{
+			vector<const Node*> path;
+		public:
+			Iterator() {}
+
+			Iterator(const vector<const Node*>& _path) : path(_path) {}
+
+			bool operator==(const Iterator& other)const{
+				return path.empty() ? other.path.empty() : !other.path.empty() && path.back() == other.path.back();
+			}
+
+			bool operator!=(const Iterator& other)const{
+				return !(*this == other);
+			}
+
+			pair<IndexT, ValueT> operator*()const{
+				return make_pair(key(), value());
+			}
+
+			const IndexT& key()const{
+				return path.back()->key;
+			}
+
+			const ValueT& value()const{
+				return path.back()->value;
+			}
+
+			bool operator!()const{
+				return path.empty();
+			}
+
+			Iterator& operator++(){
+				if (path.empty()) return *this;
+				const Node* u = path.back();
+				if (u->right){
+					for (u = u->right; u; u = u->left) path.push_back(u);
+				}
+				else {
+					path.pop_back();
+					while (!path.empty() && path.back()->right == u){
+						u = path.back();
+						path.pop_back();
+					}
+				}
+				return *this;
+			}
+
+			Iterator operator++(int){
+				Iterator tmp = *this;
+				++*this;
+				return tmp;
+			}
+
+			Iterator& operator--(){
+				if (path.empty()) return *this;
+				const Node* u = path.back();
+				if (u->left){
+					for (u = u->left; u; u = u->right) path.push_back(u);
+				}
+				else {
+					path.pop_back();
+					while (!path.empty() && path.back()->left == u){
+						u = path.back();
+						path.pop_back();
+					}
+				}
+				return *this;
+			}
+
+			Iterator operator--(int){
+				Iterator tmp = *this;
+				--*this;
+				return tmp;
+			}
+
+			operator bool()const{
+				return !path.empty();
+			}
+		};
+
+	private:
+
+		//Path to the last node that is smaller than (or equal to, if orEqual) the key,
+		//or to the first one that is greater (or equal), depending on wantSmaller
+		template<bool wantSmaller, bool orEqual>
+		Iterator search(const IndexT& key)const{
+			vector<const Node*> path;
+			size_t found = 0;
+			for (const Node* u = root; u;){
+				path.push_back(u);
+				bool goRight = orEqual ? !smaller(key, u->key) : smaller(u->key, key);
+				if (goRight == wantSmaller) found = path.size();
+				u = goRight ? u->right : u->left;
+			}
+			path.resize(found);
+			return Iterator(path);
+		}
+
+	public:
+
+		explicit GTreePersistent(const Alloc& _alloc = Alloc()) : alloc(_alloc), seed(2463534242u), root(0){}
+
+		//O(1), the copy is a snapshot of this version
+		GTreePersistent(const GTreePersistent& other) :
+			alloc(NodeTraits::select_on_container_copy_construction(other.alloc)), seed(other.seed), root(share(other.root)){}
+
+		GTreePersistent& operator=(const GTreePersistent& other){
+			if (this != &other){
+				Node* old = root;
+				root = share(other.root);
+				release(old);
+			}
+			return *this;
+		}
+
+		~GTreePersistent(){
+			release(root);
+		}
+
+		allocator_type get_allocator()const{
+			return Alloc(alloc);
+		}
+
+		//Returns true if a new key was added. Copies the search path unless only this version sees it.
+		bool insert(const IndexT& key, const ValueT& value = ValueT()){
+			bool created = false;
+			root = insert(root, key, value, created);
+			return created;
+		}
+
+		bool erase(const IndexT& key){
+			if (!find(key)) return false;
+			root = erase(root, key);
+			return true;
+		}
+
+		bool exists(const IndexT& key)const{
+			return find(key) != 0;
+		}
+
+		bool empty()const{
+			return !root;
+		}
+
+		void clear(){
+			release(root);
+			root = 0;
+		}
+
+		ValueT operator[](const IndexT& key)const{
+			const Node* p = find(key);
+			return p ? p->value : ValueT();
+		}
+
+		//Aggregate (through Plus) of the values whose keys lie in the range, O(log n) expected
+		ValueT sum(const Range<IndexT>& range)const{
+			ValueT result = ValueT();
+			bool any = false;
+			sum(root, range, false, false, result, any);
+			return result;
+		}
+
+		Iterator begin()const{
+			vector<const Node*> path;
+			for (const Node* u = root; u; u = u->left) path.push_back(u);
+			return Iterator(path);
+		}
+
+		Iterator end()const{
+			vector<const Node*> path;
+			for (const Node* u = root; u; u = u->right) path.push_back(u);
+			return Iterator(path);
+		}
+
+		Iterator outOfRange()const{
+			return Iterator();
+		}
+
+		Iterator findEqual(const IndexT& key)const{
+			Iterator it = search<false, false>(key);
+			return it && !smaller(key, it.key()) ? it : Iterator();
+		}
+
+		Iterator findSmallerEqual(const IndexT& key)const{
+			return search<true, true>(key);
+		}
+
+		Iterator findGreaterEqual(const IndexT& key)const{
+			return search<false, false>(key);
+		}
+
+		Iterator findSmaller(const IndexT& key)const{
+			return search<true, false>(key);
+		}
+
+		Iterator findGreater(const IndexT& key)const{
+			return search<false, true>(key);
+		}
+
+	};
+}
+
+#endif
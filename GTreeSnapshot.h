@@ -0,0 +1,255 @@
+#ifndef _GTREESNAPSHOT_H
+#define _GTREESNAPSHOT_H
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+
+using namespace std;
+
+namespace gtree {
+
+	//Immutable copy of a tree's contents, made by GTree::freeze() or from a sorted range.
+	//Keys are stored in Eytzinger (BFS) order: slot 1 is the root, slot k has children 2k and 2k+1,
+	//so the first levels of every search share the same few cache lines.
+	//Searches descend without branching on the comparison, reading the keys a few levels
+	//ahead, and finish with a bit trick that recovers the answer from the path taken.
+	//Nothing is ever written after construction, so any number of threads can read at once
+	//without locking, e.g. through a shared_ptr<const GTreeSnapshot>.
+	template<class IndexT, class ValueT = Void, class Comp = less<IndexT>, class Plus = plus<ValueT>,
+		class Alloc = allocator<pair<const IndexT, ValueT>>>
+	class GTreeSnapshot {
+	public:
+		typedef Alloc allocator_type;
+
+	private:
+		typedef vector<IndexT, typename allocator_traits<Alloc>::template rebind_alloc<IndexT>> KeyStore;
+		typedef vector<ValueT, typename allocator_traits<Alloc>::template rebind_alloc<ValueT>> ValueStore;
+
+		Comp smaller;
+		Plus add;
+		size_t n;
+		KeyStore keys;     //slot 0 is unused
+		ValueStore values;
+		ValueStore prefix; //aggregate of the values of all keys up to and including the one in the slot
+
+		//Slot navigation, 0 means there is no such slot
+
+		size_t first()const{
+			if (!n) return 0;
+			size_t k = 1;
+			while (2 * k <= n) k = 2 * k;
+			return k;
+		}
+
+		size_t last()const{
+			if (!n) return 0;
+			size_t k = 1;
+			while (2 * k + 1 <= n) k = 2 * k + 1;
+			return k;
+		}
+
+		size_t next(size_t k)const{
+			if (2 * k + 1 <= n){
+				k = 2 * k + 1;
+				while (2 * k <= n) k = 2 * k;
+				return k;
+			}
+			while (k & 1) k >>= 1;
+			return k >> 1;
+		}
+
+		size_t previous(size_t k)const{
+			if (2 * k <= n){
+				k = 2 * k;
+				while (2 * k + 1 <= n) k = 2 * k + 1;
+				return k;
+			}
+			while (k > 1 && !(k & 1)) k >>= 1;
+			return k >> 1;
+		}
+
+		//Walks from the root to below a leaf, going right past every key that is smaller than
+		//(or equal to, if orEqual) the given one. The bits of the result below its highest
+		//one spell out the turns taken, 1 for right.
+		template<bool orEqual>
+		size_t descend(const IndexT& key)const{
+			const IndexT* k = keys.data();
+			size_t i = 1;
+			while (i <= n){
+#ifdef __GNUC__
+				__builtin_prefetch(k + 16 * i);
+#endif
+				i = 2 * i + (orEqual ? !smaller(key, k[i]) : smaller(k[i], key));
+			}
+			return i;
+		}
+
+		//the node of the last left turn, the first key that was not passed
+		static size_t lastLeft(size_t i){
+			while (i & 1) i >>= 1;
+			return i >> 1;
+		}
+
+		//the node of the last right turn, the last key that was passed
+		static size_t lastRight(size_t i){
+			while (i > 1 && !(i & 1)) i >>= 1;
+			return i >> 1;
+		}
+
+		template<class ForwardIt>
+		void fill(ForwardIt it){
+			keys.resize(n + 1);
+			values.resize(n + 1);
+			prefix.resize(n + 1);
+			size_t before = 0;
+			for (size_t k = first(); k; k = next(k), ++it){
+				keys[k] = it->first;
+				values[k] = it->second;
+				prefix[k] = before ? add(prefix[before], it->second) : it->second;
+				before = k;
+			}
+		}
+
+	public:
+
+		class Iterator{
+			const GTreeSnapshot* snapshot;
+			size_t k;
+		public:
+			Iterator(const GTreeSnapshot& _snapshot, size_t slot = 0) : snapshot(&_snapshot), k(slot) {}
+
+			bool operator==(const Iterator& other)const{
+				return k == other.k;
+			}
+
+			bool operator!=(const Iterator& other)const{
+				return k != other.k;
+			}
+
+			pair<IndexT, ValueT> operator*()const{
+				return make_pair(key(), value());
+			}
+
+			const IndexT& key()const{
+				return snapshot->keys[k];
+			}
+
+			const ValueT& value()const{
+				return snapshot->values[k];
+			}
+
+			bool operator!()const{
+				return !k;
+			}
+
+			Iterator& operator++(){
+				if (k) k = snapshot->next(k);
+				return *this;
+			}
+
+			Iterator operator++(int){
+				Iterator tmp = *this;
+				++*this;
+				return tmp;
+			}
+
+			Iterator& operator--(){
+				if (k) k = snapshot->previous(k);
+				return *this;
+			}
+
+			Iterator operator--(int){
+				Iterator tmp = *this;
+				--*this;
+				return tmp;
+			}
+
+			operator bool()const{
+				return k != 0;
+			}
+		};
+
+		explicit GTreeSnapshot(const Alloc& alloc = Alloc()) : n(0), keys(alloc), values(alloc), prefix(alloc){}
+
+		//The (key, value) pairs must come with strictly increasing keys
+		template<class ForwardIt>
+		GTreeSnapshot(ForwardIt first, ForwardIt last, const Alloc& alloc = Alloc()) :
+			n(distance(first, last)), keys(alloc), values(alloc), prefix(alloc){
+			fill(first);
+		}
+
+		allocator_type get_allocator()const{
+			return keys.get_allocator();
+		}
+
+		size_t size()const{
+			return n;
+		}
+
+		bool empty()const{
+			return !n;
+		}
+
+		//Bytes held by the arrays
+		size_t memoryUsage()const{
+			return keys.capacity() * sizeof(IndexT) + (values.capacity() + prefix.capacity()) * sizeof(ValueT);
+		}
+
+		bool exists(const IndexT& key)const{
+			return findEqual(key);
+		}
+
+		ValueT operator[](const IndexT& key)const{
+			Iterator it = findEqual(key);
+			return it ? it.value() : ValueT();
+		}
+
+		//Aggregate of the values with keys up to the given one
+		ValueT sumPrefix(const IndexT& key, bool inclusive = true)const{
+			size_t k = inclusive ? lastRight(descend<true>(key)) : lastRight(descend<false>(key));
+			return k ? prefix[k] : ValueT();
+		}
+
+		Iterator begin()const{
+			return Iterator(*this, first());
+		}
+
+		Iterator end()const{
+			return Iterator(*this, last());
+		}
+
+		Iterator outOfRange()const{
+			return Iterator(*this, 0);
+		}
+
+		Iterator findEqual(const IndexT& key)const{
+			size_t k = lastLeft(descend<false>(key));
+			return Iterator(*this, k && !smaller(key, keys[k]) ? k : 0);
+		}
+
+		Iterator findSmallerEqual(const IndexT& key)const{
+			return Iterator(*this, lastRight(descend<true>(key)));
+		}
+
+		Iterator findGreaterEqual(const IndexT& key)const{
+			return Iterator(*this, lastLeft(descend<false>(key)));
+		}
+
+		Iterator findSmaller(const IndexT& key)const{
+			return Iterator(*this, lastRight(descend<false>(key)));
+		}
+
+		Iterator findGreater(const IndexT& key)const{
+			return Iterator(*this, lastLeft(descend<true>(key)));
+		}
+
+	};
+}
+
+#endif
@@ -0,0 +1,535 @@
+#ifndef _GTREETOPDOWN_H
+#define _GTREETOPDOWN_H
+
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+#include "NodePool.h"
+
+using namespace std;
+
+namespace gtree {
+
+	//Splay tree restructured top-down (Sleator-Tarjan) in a single pass over the
+	//access path. Nodes carry no parent pointer.
+	//Takes the template parameters of GTreeLazy and offers the interface of GTree,
+	//together with sum/updateRange over a Range. With the default NoUpdate it is a
+	//drop-in replacement for GTree, otherwise it does what GTreeLazy does.
+	template<
+		class IndexT,
+		class ValueT = Void,
+		class CumulativeValueT = ValueT,
+		class UpdateT = NoUpdate<ValueT, CumulativeValueT>,
+		class Comp = less<IndexT>,
+		class Adder = _gtree_plus<ValueT, ValueT, CumulativeValueT>,
+		class Updater = _gtree_plus<UpdateT, ValueT, ValueT>,
+		class CumulativeUpdater = _gtree_plus<UpdateT, CumulativeValueT, CumulativeValueT>,
+		class UpdateAdder = _gtree_plus<UpdateT, UpdateT, UpdateT>,
+		class Alloc = allocator<pair<const IndexT, ValueT>>
+	>
+	class GTreeTopDown {
+	public:
+		typedef Alloc allocator_type;
+
+	private:
+		struct Node {
+			Node* left;
+			Node* right;
+			IndexT key;
+			ValueT value;
+			CumulativeValueT cumulativeValue;
+			UpdateT update;
+
+			Node(const IndexT& keyInit, const ValueT& valueInit) :
+				left(0), right(0),
+				key(keyInit), value(valueInit), cumulativeValue(valueInit), update() {}
+
+		};
+
+		typedef NodePool<Node, Alloc> Pool;
+		typedef vector<Node*, typename allocator_traits<Alloc>::template rebind_alloc<Node*>> NodeStack;
+
+		Comp smaller;
+		Adder adder;
+		Updater updater;
+		CumulativeUpdater cumulativeUpdater;
+		UpdateAdder updateAdder;
+		Pool pool;
+		Node* root;
+		//nodes hung on the left/right assembly trees during a splay,
+		//kept around so their aggregates can be repaired bottom-up afterwards
+		NodeStack leftSpine, rightSpine;
+
+		//Splay directions: <0 go left, >0 go right, 0 stop here
+		struct ToKey {
+			const Comp& smaller;
+			const IndexT& key;
+			int operator()(const Node* node)const{
+				if (smaller(key, node->key)) return -1;
+				if (smaller(node->key, key)) return 1;
+				return 0;
+			}
+		};
+
+		struct ToMinimum {
+			int operator()(const Node*)const{
+				return -1;
+			}
+		};
+
+		struct ToMaximum {
+			int operator()(const Node*)const{
+				return 1;
+			}
+		};
+
+		ToKey toKey(const IndexT& key)const{
+			ToKey dir = { smaller, key };
+			return dir;
+		}
+
+		//Pushes the pending update one level down. MUST be done before the children are touched
+		void push(Node* node){
+			if (!node) return;
+			node->value = updater(node->update, node->value);
+			node->cumulativeValue = cumulativeUpdater(node->update, node->cumulativeValue);
+			if (node->left) node->left->update = updateAdder(node->left->update, node->update);
+			if (node->right) node->right->update = updateAdder(node->right->update, node->update);
+			node->update = UpdateT();
+		}
+
+		//Recomputes the aggregate of a node from its children
+		void pull(Node* node){
+			push(node->left);
+			push(node->right);
+			if (!node->left && !node->right){
+				node->cumulativeValue = node->value;
+			}
+			else if (!node->left){
+				node->cumulativeValue = adder(node->value, node->right->cumulativeValue);
+			}
+			else if (!node->right){
+				node->cumulativeValue = adder(node->left->cumulativeValue, node->value);
+			}
+			else {
+				node->cumulativeValue = adder(adder(node->left->cumulativeValue, node->value), node->right->cumulativeValue);
+			}
+		}
+
+		//Splays the node the direction leads to and returns the new root of the subtree.
+		//Nodes passed on the way are hung on the left tree (smaller) or the right tree (greater);
+		//only the spines of those two trees need their aggregates repaired afterwards.
+		template<class Dir>
+		Node* splay(Node* t, Dir dir){
+			if (!t) return 0;
+			Node* leftTree = 0;
+			Node* rightTree = 0;
+			Node** leftHook = &leftTree; //where the next smaller node goes
+			Node** rightHook = &rightTree; //where the next greater node goes
+			leftSpine.clear();
+			rightSpine.clear();
+
+			while (1){
+				push(t);
+				int d = dir(t);
+				if (d < 0){
+					if (!t->left) break;
+					push(t->left);
+					if (dir(t->left) < 0){
+						//zig-zig, rotate right
+						Node* y = t->left;
+						t->left = y->right;
+						y->right = t;
+						pull(t);
+						t = y;
+						if (!t->left) break;
+					}
+					//link right
+					*rightHook = t;
+					rightHook = &t->left;
+					rightSpine.push_back(t);
+					t = t->left;
+				}
+				else if (d > 0){
+					if (!t->right) break;
+					push(t->right);
+					if (dir(t->right) > 0){
+						//zig-zig, rotate left
+						Node* y = t->right;
+						t->right = y->left;
+						y->left = t;
+						pull(t);
+						t = y;
+						if (!t->right) break;
+					}
+					//link left
+					*leftHook = t;
+					leftHook = &t->right;
+					leftSpine.push_back(t);
+					t = t->right;
+				}
+				else break;
+			}
+
+			//assemble
+			*leftHook = t->left;
+			*rightHook = t->right;
+			for (size_t i = leftSpine.size(); i--;) pull(leftSpine[i]);
+			for (size_t i = rightSpine.size(); i--;) pull(rightSpine[i]);
+			t->left = leftTree;
+			t->right = rightTree;
+			pull(t);
+			return t;
+		}
+
+		//Every key in a must be smaller than every key in b
+		Node* join(Node* a, Node* b){
+			if (!a) return b;
+			if (!b) return a;
+			a = splay(a, ToMaximum());
+			a->right = b;
+			pull(a);
+			return a;
+		}
+
+		//Makes the successor (next) or the predecessor of the root the new root and returns it
+		template<bool next>
+		Node* step(){
+			Node* child = next ? root->right : root->left;
+			if (!child) return 0;
+			if (next){
+				child = splay(child, ToMinimum());
+				root->right = child->left;
+				child->left = root;
+			}
+			else {
+				child = splay(child, ToMaximum());
+				root->left = child->right;
+				child->right = root;
+			}
+			pull(root);
+			pull(child);
+			root = child;
+			return root;
+		}
+
+		//Cuts the tree into the nodes below the range, inside it and above it.
+		//The tree is empty afterwards, rejoin puts it back together.
+		void split(const Range<IndexT>& range, Node*& below, Node*& inside, Node*& above){
+			below = above = 0;
+			inside = root;
+			root = 0;
+			if (inside && range.l_type){
+				inside = splay(inside, toKey(range.l_val));
+				bool rootBelow = range.l_type == 1 ?
+					smaller(inside->key, range.l_val) : !smaller(range.l_val, inside->key);
+				if (rootBelow){
+					below = inside;
+					inside = below->right;
+					below->right = 0;
+					pull(below);
+				}
+				else {
+					below = inside->left;
+					inside->left = 0;
+					pull(inside);
+				}
+			}
+			if (inside && range.r_type){
+				inside = splay(inside, toKey(range.r_val));
+				bool rootAbove = range.r_type == 1 ?
+					smaller(range.r_val, inside->key) : !smaller(inside->key, range.r_val);
+				if (rootAbove){
+					above = inside;
+					inside = above->left;
+					above->left = 0;
+					pull(above);
+				}
+				else {
+					above = inside->right;
+					inside->right = 0;
+					pull(inside);
+				}
+			}
+		}
+
+		void rejoin(Node* below, Node* inside, Node* above){
+			root = join(join(below, inside), above);
+		}
+
+		//Frees a subtree without parent pointers or a stack:
+		//left children are rotated up until the root has none, then the root goes.
+		void destroy(Node* t){
+			while (t){
+				if (t->left){
+					Node* l = t->left;
+					t->left = l->right;
+					l->right = t;
+					t = l;
+				}
+				else {
+					Node* r = t->right;
+					pool.destroy(t);
+					t = r;
+				}
+			}
+		}
+
+		//Nonrecursive, pending updates are copied as they are
+		Node* clone(const GTreeTopDown& other){
+			if (!other.root) return 0;
+			Node* newRoot = 0;
+			vector<pair<const Node*, Node**>, typename allocator_traits<Alloc>::template rebind_alloc<pair<const Node*, Node**>>>
+				stack(pool.allocator());
+			stack.push_back(make_pair(other.root, &newRoot));
+			while (!stack.empty()){
+				const Node* from = stack.back().first;
+				Node** to = stack.back().second;
+				stack.pop_back();
+				Node* copy = pool.create(*from);
+				copy->left = copy->right = 0;
+				*to = copy;
+				if (from->left) stack.push_back(make_pair(from->left, &copy->left));
+				if (from->right) stack.push_back(make_pair(from->right, &copy->right));
+			}
+			return newRoot;
+		}
+
+	public:
+
+		class Iterator{
+			GTreeTopDown* tree;
+			Node* p;
+		public:
+			Iterator(GTreeTopDown& _tree, Node* ptr = 0) : tree(&_tree), p(ptr) {}
+
+			bool operator==(const Iterator& other)const{
+				return p == other.p;
+			}
+
+			bool operator!=(const Iterator& other)const{
+				return p != other.p;
+			}
+
+			pair<IndexT, ValueT> operator*()const{
+				return make_pair(p->key, p->value);
+			}
+
+			IndexT key(){
+				return p->key;
+			}
+
+			ValueT value(){
+				return p->value;
+			}
+
+			bool operator!(){
+				return !p;
+			}
+
+			//no parent pointers, so the iterator finds its way back by key
+			Iterator& operator++(){
+				if (!p) return *this;
+				tree->root = tree->splay(tree->root, tree->toKey(p->key));
+				p = tree->template step<true>();
+				return *this;
+			}
+
+			Iterator operator++(int){
+				Iterator tmp = *this;
+				++*this;
+				return tmp;
+			}
+
+			Iterator& operator--(){
+				if (!p) return *this;
+				tree->root = tree->splay(tree->root, tree->toKey(p->key));
+				p = tree->template step<false>();
+				return *this;
+			}
+
+			Iterator operator--(int){
+				Iterator tmp = *this;
+				--*this;
+				return tmp;
+			}
+
+			operator bool(){
+				return p != 0;
+			}
+		};
+
+		explicit GTreeTopDown(const Alloc& alloc = Alloc()) :
+			pool(alloc), root(0), leftSpine(alloc), rightSpine(alloc){}
+
+		GTreeTopDown(const GTreeTopDown& other) :
+			pool(allocator_traits<Alloc>::select_on_container_copy_construction(other.pool.allocator())),
+			root(0), leftSpine(pool.allocator()), rightSpine(pool.allocator()){
+			root = clone(other);
+		}
+
+		//The allocator is not propagated, the copy is made with our own
+		GTreeTopDown& operator=(const GTreeTopDown& other){
+			if (this != &other){
+				clear();
+				root = clone(other);
+			}
+			return *this;
+		}
+
+		~GTreeTopDown(){
+			clear();
+		}
+
+		allocator_type get_allocator()const{
+			return pool.allocator();
+		}
+
+		pair<Iterator, bool> insert(const IndexT& key, const ValueT& value = ValueT()){
+			if (!root){
+				root = pool.create(key, value);
+				return make_pair(Iterator(*this, root), true);
+			}
+			root = splay(root, toKey(key));
+			if (!smaller(key, root->key) && !smaller(root->key, key)){
+				root->value = value;
+				pull(root);
+				return make_pair(Iterator(*this, root), false);
+			}
+			Node* z = pool.create(key, value);
+			if (smaller(key, root->key)){
+				z->left = root->left;
+				z->right = root;
+				root->left = 0;
+			}
+			else {
+				z->right = root->right;
+				z->left = root;
+				root->right = 0;
+			}
+			pull(root);
+			pull(z);
+			root = z;
+			return make_pair(Iterator(*this, root), true);
+		}
+
+		bool erase(const IndexT& key){
+			if (!root) return false;
+			root = splay(root, toKey(key));
+			if (smaller(key, root->key) || smaller(root->key, key)) return false;
+			Node* left = root->left;
+			Node* right = root->right;
+			pool.destroy(root);
+			root = join(left, right);
+			return true;
+		}
+
+		bool exists(const IndexT& key){
+			return findEqual(key);
+		}
+
+		bool exists(const IndexT& key)const{
+			Node* node = root;
+			while (node){
+				if (smaller(node->key, key)) node = node->right;
+				else if (smaller(key, node->key)) node = node->left;
+				else return true;
+			}
+			return false;
+		}
+
+		bool empty()const{
+			return !root;
+		}
+
+		void clear(){
+			if (is_trivially_destructible<Node>::value) pool.release();
+			else destroy(root);
+			root = 0;
+		}
+
+		//use only for retrieving values.
+		ValueT operator[](const IndexT& key){
+			Iterator it = findEqual(key);
+			if (!it) return ValueT();
+			return it.value();
+		}
+
+		//Aggregate of all the values whose keys lie in the range
+		CumulativeValueT sum(const Range<IndexT>& range){
+			Node *below, *inside, *above;
+			split(range, below, inside, above);
+			CumulativeValueT result = CumulativeValueT();
+			if (inside){
+				push(inside);
+				result = inside->cumulativeValue;
+			}
+			rejoin(below, inside, above);
+			return result;
+		}
+
+		//Applies the update lazily to all the values whose keys lie in the range
+		void updateRange(const Range<IndexT>& range, const UpdateT& update){
+			Node *below, *inside, *above;
+			split(range, below, inside, above);
+			if (inside) inside->update = updateAdder(inside->update, update);
+			rejoin(below, inside, above);
+		}
+
+		Iterator begin(){
+			root = splay(root, ToMinimum());
+			return Iterator(*this, root);
+		}
+
+		Iterator end(){
+			root = splay(root, ToMaximum());
+			return Iterator(*this, root);
+		}
+
+		Iterator outOfRange(){
+			return Iterator(*this, 0);
+		}
+
+		Iterator findEqual(const IndexT& key){
+			if (!root) return outOfRange();
+			root = splay(root, toKey(key));
+			if (smaller(key, root->key) || smaller(root->key, key)) return outOfRange();
+			return Iterator(*this, root);
+		}
+
+		Iterator findSmallerEqual(const IndexT& key){
+			if (!root) return outOfRange();
+			root = splay(root, toKey(key));
+			if (!smaller(key, root->key)) return Iterator(*this, root);
+			return Iterator(*this, step<false>());
+		}
+
+		Iterator findGreaterEqual(const IndexT& key){
+			if (!root) return outOfRange();
+			root = splay(root, toKey(key));
+			if (!smaller(root->key, key)) return Iterator(*this, root);
+			return Iterator(*this, step<true>());
+		}
+
+		Iterator findSmaller(const IndexT& key){
+			if (!root) return outOfRange();
+			root = splay(root, toKey(key));
+			if (smaller(root->key, key)) return Iterator(*this, root);
+			return Iterator(*this, step<false>());
+		}
+
+		Iterator findGreater(const IndexT& key){
+			if (!root) return outOfRange();
+			root = splay(root, toKey(key));
+			if (smaller(key, root->key)) return Iterator(*this, root);
+			return Iterator(*this, step<true>());
+		}
+
+	};
+}
+
+#endif
@@ -0,0 +1,333 @@
+#ifndef _NODEPOOL_H
+#define _NODEPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace gtree {
+
+	//Slab allocator for tree nodes.
+	//Nodes are carved out of slabs that grow geometrically up to maxSlabNodes,
+	//freed nodes are kept on a free list and reused before the slab is touched.
+	//release() gives back every slab at once without looking at the nodes.
+	//Slabs are obtained from a copy of the given allocator, rebound as needed.
+	//Pools that share() end up in one family and may then free each other's nodes,
+	//which is what lets trees hand nodes over to each other. The slabs of a family
+	//are only freed once every pool in it is gone.
+	//Nodes can also be destroyed on another thread through a Retirement, their slots
+	//come back to the pool the next time its free list runs dry.
+	template<class Node, class Alloc = std::allocator<Node>>
+	class NodePool {
+	private:
+		static const size_t minSlabNodes = 16;
+		static const size_t maxSlabNodes = 4096;
+
+		union Slot {
+			Slot* next;
+			struct {
+				Slot* next;
+				size_t count;
+			} slab; //header, lives in the first slot of every slab
+			typename std::aligned_storage<sizeof(Node), alignof(Node)>::type node;
+		};
+
+		typedef typename std::allocator_traits<Alloc>::template rebind_alloc<Slot> SlotAlloc;
+		typedef std::allocator_traits<SlotAlloc> SlotTraits;
+
+		//Keeps the slabs of pools that left the family, along with the slots they did not use,
+		//which the members still alive take over once their own run out. Families that get merged
+		//forward to one root which collects both, every member keeps that root alive.
+		struct Family {
+			SlotAlloc alloc;
+			Slot* slabs;
+			Slot* freeList;
+			std::shared_ptr<Family> parent;
+
+			explicit Family(const SlotAlloc& _alloc) : alloc(_alloc), slabs(0), freeList(0){}
+
+			~Family(){
+				freeSlabs(alloc, slabs);
+			}
+		};
+
+		//guards the links between families and their slab lists, only taken by share() and when a member dies
+		static std::mutex& familyLock(){
+			static std::mutex lock;
+			return lock;
+		}
+
+		//the family lock must be held
+		static std::shared_ptr<Family> root(std::shared_ptr<Family>& family){
+			while (family->parent){
+				if (family->parent->parent) family->parent = family->parent->parent;
+				family = family->parent;
+			}
+			return family;
+		}
+
+		//moves the slots of chain, linked through next, to the front of list
+		static void splice(Slot*& list, Slot* chain){
+			if (!chain) return;
+			Slot* last = chain;
+			while (last->next) last = last->next;
+			last->next = list;
+			list = chain;
+		}
+
+		static void freeSlabs(SlotAlloc& alloc, Slot* slabs){
+			while (slabs){
+				Slot* next = slabs->slab.next;
+				SlotTraits::deallocate(alloc, slabs, slabs->slab.count);
+				slabs = next;
+			}
+		}
+
+		//Slots handed back by retirements, and how many retirements are still out
+		struct Returns {
+			std::atomic<Slot*> chains; //linked through next
+			std::mutex lock;
+			std::condition_variable idle;
+			size_t pending;
+
+			Returns() : chains(0), pending(0){}
+		};
+
+		SlotAlloc alloc;
+		std::shared_ptr<Family> family;
+		std::shared_ptr<Returns> returns; //made by the first retire()
+
+		Slot* slabs; //list of slabs, linked through their headers
+		Slot* freeList;
+		Slot* cursor; //first never used slot of the newest slab
+		Slot* limit;
+		size_t nextSlabNodes;
+
+		void grow(){
+			size_t count = nextSlabNodes + 1;
+			Slot* slab = std::addressof(*SlotTraits::allocate(alloc, count));
+			slab->slab.next = slabs;
+			slab->slab.count = count;
+			slabs = slab;
+			cursor = slab + 1;
+			limit = slab + count;
+			if (nextSlabNodes < maxSlabNodes) nextSlabNodes *= 2;
+		}
+
+		//retirements write into our slabs, so they have to be done before the slabs can go
+		void waitForReturns(){
+			if (!returns) return;
+			std::unique_lock<std::mutex> guard(returns->lock);
+			returns->idle.wait(guard, [this]{ return returns->pending == 0; });
+		}
+
+		//moves the free slots, returned ones included, to the family, whose lock must be held
+		void handOver(Family& keeper){
+			if (returns) splice(freeList, returns->chains.exchange(0, std::memory_order_acquire));
+			splice(keeper.freeList, freeList);
+			freeList = 0;
+		}
+
+		Slot* take(){
+			if (!freeList && returns) freeList = returns->chains.exchange(0, std::memory_order_acquire);
+			if (freeList){
+				Slot* s = freeList;
+				freeList = s->next;
+				return s;
+			}
+			if (cursor == limit && family){
+				//slots left behind by members that are gone come before a new slab
+				std::lock_guard<std::mutex> guard(familyLock());
+				std::shared_ptr<Family> keeper = root(family);
+				if (keeper->freeList){
+					Slot* s = keeper->freeList;
+					freeList = s->next;
+					keeper->freeList = 0;
+					return s;
+				}
+			}
+			if (cursor == limit) grow();
+			return cursor++;
+		}
+
+	public:
+		explicit NodePool(const Alloc& _alloc = Alloc()) :
+			alloc(_alloc), slabs(0), freeList(0), cursor(0), limit(0), nextSlabNodes(minSlabNodes) {}
+
+		NodePool(const NodePool&) = delete;
+		NodePool& operator=(const NodePool&) = delete;
+
+		~NodePool(){
+			waitForReturns();
+			if (!family){
+				release();
+				return;
+			}
+			//other members may still use nodes in our slabs
+			std::lock_guard<std::mutex> guard(familyLock());
+			std::shared_ptr<Family> keeper = root(family);
+			while (slabs){
+				Slot* next = slabs->slab.next;
+				slabs->slab.next = keeper->slabs;
+				keeper->slabs = slabs;
+				slabs = next;
+			}
+			//our free slots go along, the others reuse them instead of growing
+			handOver(*keeper);
+			for (; cursor != limit; cursor++){
+				cursor->next = keeper->freeList;
+				keeper->freeList = cursor;
+			}
+		}
+
+		template<class... Args>
+		Node* create(Args&&... args){
+			Slot* s = take();
+			try {
+				return new (&s->node) Node(std::forward<Args>(args)...);
+			}
+			catch (...) {
+				s->next = freeList;
+				freeList = s;
+				throw;
+			}
+		}
+
+		void destroy(Node* node){
+			node->~Node();
+			Slot* s = reinterpret_cast<Slot*>(node);
+			s->next = freeList;
+			freeList = s;
+		}
+
+		//Destroys nodes without touching the pool, so it may be used on any thread.
+		//The slots are chained up and handed back to the pool in one piece when the retirement
+		//is destroyed. The pool waits for its retirements before freeing slabs.
+		class Retirement {
+			std::shared_ptr<Returns> returns;
+			Slot* first;
+			Slot* last;
+			size_t count;
+
+		public:
+			explicit Retirement(const std::shared_ptr<Returns>& _returns) : returns(_returns), first(0), last(0), count(0){
+				std::lock_guard<std::mutex> guard(returns->lock);
+				returns->pending++;
+			}
+
+			Retirement(const Retirement&) = delete;
+			Retirement& operator=(const Retirement&) = delete;
+
+			~Retirement(){
+				if (first){
+					Slot* head = returns->chains.load(std::memory_order_relaxed);
+					do {
+						last->next = head;
+					} while (!returns->chains.compare_exchange_weak(head, first, std::memory_order_release, std::memory_order_relaxed));
+				}
+				std::lock_guard<std::mutex> guard(returns->lock);
+				if (--returns->pending == 0) returns->idle.notify_all();
+			}
+
+			void destroy(Node* node){
+				node->~Node();
+				Slot* s = reinterpret_cast<Slot*>(node);
+				s->next = first;
+				first = s;
+				if (!last) last = s;
+				count++;
+			}
+
+			//nodes destroyed so far
+			size_t destroyed()const{
+				return count;
+			}
+		};
+
+		//Only to be called on the thread that uses the pool, the retirement may then go anywhere
+		std::shared_ptr<Retirement> retire(){
+			if (!returns) returns = std::make_shared<Returns>();
+			return std::make_shared<Retirement>(returns);
+		}
+
+		Alloc allocator()const{
+			return Alloc(alloc);
+		}
+
+		//Bytes held in slabs, including nodes that are free or not yet used
+		size_t memoryUsage()const{
+			size_t total = 0;
+			for (Slot* slab = slabs; slab; slab = slab->slab.next) total += slab->slab.count * sizeof(Slot);
+			return total;
+		}
+
+		//Puts both pools into one family, after that either may destroy nodes created by the other.
+		//Only valid if the two allocators compare equal.
+		void share(NodePool& other){
+			std::lock_guard<std::mutex> guard(familyLock());
+			if (!family) family = std::allocate_shared<Family>(alloc, alloc);
+			std::shared_ptr<Family> ours = root(family);
+			if (!other.family){
+				other.family = ours;
+				return;
+			}
+			std::shared_ptr<Family> theirs = root(other.family);
+			if (theirs == ours) return;
+			while (theirs->slabs){
+				Slot* next = theirs->slabs->slab.next;
+				theirs->slabs->slab.next = ours->slabs;
+				ours->slabs = theirs->slabs;
+				theirs->slabs = next;
+			}
+			splice(ours->freeList, theirs->freeList);
+			theirs->freeList = 0;
+			theirs->parent = ours;
+		}
+
+		//Gives the free slots to the family, the next member that runs out takes them over.
+		//Lets the slots freed by one pool be reused by another that only allocates.
+		//Nothing happens for pools outside a family.
+		void handOver(){
+			if (!family) return;
+			std::lock_guard<std::mutex> guard(familyLock());
+			handOver(*root(family));
+		}
+
+		//Pools outside a family own all the nodes in their slabs and may release() them
+		bool exclusive()const{
+			return !family;
+		}
+
+		//Exchanges the slabs and families, the allocators stay where they are.
+		//Only valid if the two allocators compare equal.
+		void swap(NodePool& other){
+			std::swap(family, other.family);
+			std::swap(returns, other.returns);
+			std::swap(slabs, other.slabs);
+			std::swap(freeList, other.freeList);
+			std::swap(cursor, other.cursor);
+			std::swap(limit, other.limit);
+			std::swap(nextSlabNodes, other.nextSlabNodes);
+		}
+
+		//Frees all slabs. Nodes still living in them are not destroyed,
+		//the caller has to do that first unless Node is trivially destructible.
+		//Only for exclusive pools.
+		void release(){
+			waitForReturns();
+			returns.reset(); //whatever came back lived in the slabs
+			freeSlabs(alloc, slabs);
+			slabs = 0;
+			freeList = cursor = limit = 0;
+			nextSlabNodes = minSlabNodes;
+		}
+	};
+
+}
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef _RECLAIMER_H
+#define _RECLAIMER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace gtree {
+
+	//Frees memory on a thread of its own, so that dropping many nodes does not stall the caller.
+	//Jobs run one at a time in the order they came, each returns how many nodes it freed.
+	//One reclaimer can serve any number of trees. The destructor finishes every job submitted.
+	class Reclaimer {
+	private:
+		mutable std::mutex lock;
+		std::condition_variable wake; //a job came or we are stopping
+		std::condition_variable idle; //the backlog ran out
+		std::deque<std::function<size_t()>> jobs;
+		size_t unfinished; //queued or running
+		bool stopping;
+		std::atomic<size_t> freed;
+		std::thread worker;
+
+		void run(){
+			std::unique_lock<std::mutex> guard(lock);
+			while (1){
+				wake.wait(guard, [this]{ return stopping || !jobs.empty(); });
+				if (jobs.empty()) return;
+				std::function<size_t()> job = std::move(jobs.front());
+				jobs.pop_front();
+				guard.unlock();
+				freed.fetch_add(job(), std::memory_order_relaxed);
+				job = nullptr; //whatever the job held goes now, on this thread
+				guard.lock();
+				if (--unfinished == 0) idle.notify_all();
+			}
+		}
+
+	public:
+		Reclaimer() : unfinished(0), stopping(false), freed(0){
+			worker = std::thread([this]{ run(); });
+		}
+
+		Reclaimer(const Reclaimer&) = delete;
+		Reclaimer& operator=(const Reclaimer&) = delete;
+
+		~Reclaimer(){
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				stopping = true;
+			}
+			wake.notify_one();
+			worker.join();
+		}
+
+		void submit(std::function<size_t()> job){
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				jobs.push_back(std::move(job));
+				unfinished++;
+			}
+			wake.notify_one();
+		}
+
+		//Jobs submitted but not finished yet
+		size_t backlog()const{
+			std::lock_guard<std::mutex> guard(lock);
+			return unfinished;
+		}
+
+		//Nodes freed by all finished jobs so far
+		size_t reclaimed()const{
+			return freed.load(std::memory_order_relaxed);
+		}
+
+		//Blocks until every job submitted so far is done
+		void wait(){
+			std::unique_lock<std::mutex> guard(lock);
+			idle.wait(guard, [this]{ return unfinished == 0; });
+		}
+	};
+
+	//Frees dropped trees a bounded number of nodes at a time, for trees that reclaim incrementally.
+	//The walk is the one clear() does: children are unlinked on the way down and a node is
+	//freed once it has none left, so all it has to remember is the node it is at.
+	//Nodes need left, right and parent links, the roots of the dropped trees no parent.
+	template<class Node>
+	class IncrementalReclaim {
+	private:
+		std::vector<Node*> dropped; //the walk is in the last one
+		size_t freed;
+
+	public:
+		IncrementalReclaim() : freed(0){}
+
+		void add(Node* root){
+			if (root) dropped.push_back(root);
+		}
+
+		bool empty()const{
+			return dropped.empty();
+		}
+
+		//Nodes freed so far
+		size_t reclaimed()const{
+			return freed;
+		}
+
+		//Hands up to limit nodes to destroy, returns how many it did
+		template<class Destroy>
+		size_t step(size_t limit, Destroy destroy){
+			size_t n = 0;
+			while (n < limit && !dropped.empty()){
+				Node* p = dropped.back();
+				if (p->left){
+					dropped.back() = p->left;
+					p->left = 0;
+				}
+				else if (p->right){
+					dropped.back() = p->right;
+					p->right = 0;
+				}
+				else {
+					if (p->parent) dropped.back() = p->parent;
+					else dropped.pop_back();
+					destroy(p);
+					n++;
+				}
+			}
+			freed += n;
+			return n;
+		}
+
+		void swap(IncrementalReclaim& other){
+			dropped.swap(other.dropped);
+			std::swap(freed, other.freed);
+		}
+	};
+
+}
+
+#endif
@@ -0,0 +1,240 @@
+#ifndef _SHARDEDGTREE_H
+#define _SHARDEDGTREE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+#include "GTree.h"
+
+using namespace std;
+
+namespace gtree {
+
+	//Ordered map for many threads: the key space is cut into ranges, each kept in a GTree
+	//of its own behind its own lock, so threads working on different ranges do not meet.
+	//Every rebalancePeriod operations the shards are looked over; one that holds too many keys
+	//or got too many of the recent accesses hands half of its keys to a new shard (while there
+	//are fewer than maxShards) or to its smaller neighbour, by a split and a concat, O(log n).
+	//Lookups hold the boundary lock shared, only rebalancing takes it exclusively.
+	template<class IndexT, class ValueT = Void, class Comp = less<IndexT>, class Plus = plus<ValueT>,
+		class Alloc = allocator<pair<const IndexT, ValueT>>>
+	class ShardedGTree {
+	public:
+		typedef Alloc allocator_type;
+		typedef GTree<IndexT, ValueT, Comp, Plus, Alloc, true> Tree;
+
+	private:
+		struct Shard {
+			mutex lock;
+			Tree tree;
+			size_t accesses;
+
+			explicit Shard(const Alloc& alloc) : tree(alloc), accesses(0){}
+		};
+
+		typedef unique_ptr<Shard> ShardPtr;
+
+		Comp smaller;
+		Plus add;
+		Alloc alloc;
+		size_t maxShards;
+		size_t rebalancePeriod;
+		mutable shared_mutex boundaries; //guards shards and lows
+		vector<ShardPtr> shards;
+		vector<IndexT> lows; //lows[i] is the smallest key that may go to shard i + 1
+		atomic<size_t> operations;
+
+		//the boundary lock must be held
+		size_t shardOf(const IndexT& key)const{
+			return upper_bound(lows.begin(), lows.end(), key, smaller) - lows.begin();
+		}
+
+		//Runs f on the tree of the shard the key belongs to, under the shard's lock
+		template<class F>
+		auto withShard(const IndexT& key, F f) -> decltype(f(declval<Tree&>())){
+			if (++operations % rebalancePeriod == 0) rebalance();
+			shared_lock<shared_mutex> guard(boundaries);
+			Shard& shard = *shards[shardOf(key)];
+			lock_guard<mutex> shardGuard(shard.lock);
+			shard.accesses++;
+			return f(shard.tree);
+		}
+
+		//moves the keys of shard i from its median on into shard i + 1
+		//the boundary lock must be held exclusively
+		//The nodes are only relinked, every shard keeps its own pool: the one split off is empty
+		//by the time it goes, so no free slots are left behind with it.
+		void moveUpperHalf(size_t i){
+			Tree& tree = shards[i]->tree;
+			Tree& next = shards[i + 1]->tree;
+			IndexT median = tree.kth(tree.size() / 2).key();
+			Tree upper = tree.split(median);
+			upper.concat(next);
+			next.concat(upper);
+			lows[i] = median;
+		}
+
+		//moves the keys of shard i below its median into shard i - 1
+		void moveLowerHalf(size_t i){
+			Tree& tree = shards[i]->tree;
+			IndexT median = tree.kth(tree.size() / 2).key();
+			Tree upper = tree.split(median);
+			shards[i - 1]->tree.concat(tree);
+			tree.concat(upper);
+			lows[i - 1] = median;
+		}
+
+		void rebalance(){
+			unique_lock<shared_mutex> guard(boundaries);
+			size_t total = 0, accesses = 0;
+			for (ShardPtr& shard : shards){
+				total += shard->tree.size();
+				accesses += shard->accesses;
+			}
+			size_t worst = 0;
+			double worstLoad = 0;
+			for (size_t i = 0; i < shards.size(); i++){
+				//share of the keys or of the accesses, whichever is bigger, relative to a fair share
+				double load = max(total ? double(shards[i]->tree.size()) / total : 0.0,
+					accesses ? double(shards[i]->accesses) / accesses : 0.0) * shards.size();
+				if (load > worstLoad){
+					worstLoad = load;
+					worst = i;
+				}
+			}
+			for (ShardPtr& shard : shards){
+				shard->accesses = 0;
+				//nodes freed in one shard go to whichever grows next, so a range that only
+				//loses keys does not keep their memory
+				shard->tree.handOverFreeNodes();
+			}
+			size_t n = shards[worst]->tree.size();
+			if (n < 2 || (worstLoad < 2 && shards.size() == maxShards)) return;
+
+			if (shards.size() < maxShards){
+				//a new shard right after the worst one
+				shards.insert(shards.begin() + worst + 1, ShardPtr(new Shard(alloc)));
+				lows.insert(lows.begin() + worst, IndexT());
+				moveUpperHalf(worst);
+				return;
+			}
+			size_t left = worst > 0 ? shards[worst - 1]->tree.size() : n;
+			size_t right = worst + 1 < shards.size() ? shards[worst + 1]->tree.size() : n;
+			//only if the neighbour ends up smaller than what stays, otherwise keys would go back and forth
+			if (min(left, right) + n / 2 >= n) return;
+			if (left <= right) moveLowerHalf(worst);
+			else moveUpperHalf(worst);
+		}
+
+	public:
+		explicit ShardedGTree(size_t _maxShards = 16, size_t _rebalancePeriod = 1 << 16, const Alloc& _alloc = Alloc()) :
+			alloc(_alloc), maxShards(_maxShards ? _maxShards : 1),
+			rebalancePeriod(_rebalancePeriod ? _rebalancePeriod : 1), operations(0){
+			shards.push_back(ShardPtr(new Shard(alloc)));
+		}
+
+		ShardedGTree(const ShardedGTree&) = delete;
+		ShardedGTree& operator=(const ShardedGTree&) = delete;
+
+		allocator_type get_allocator()const{
+			return alloc;
+		}
+
+		size_t shardCount()const{
+			shared_lock<shared_mutex> guard(boundaries);
+			return shards.size();
+		}
+
+		//Bytes held by the node pools of the shards, including free nodes
+		size_t memoryUsage()const{
+			shared_lock<shared_mutex> guard(boundaries);
+			size_t total = 0;
+			for (const ShardPtr& shard : shards){
+				lock_guard<mutex> shardGuard(shard->lock);
+				total += shard->tree.memoryUsage();
+			}
+			return total;
+		}
+
+		size_t size()const{
+			shared_lock<shared_mutex> guard(boundaries);
+			size_t n = 0;
+			for (const ShardPtr& shard : shards){
+				lock_guard<mutex> shardGuard(shard->lock);
+				n += shard->tree.size();
+			}
+			return n;
+		}
+
+		//Returns true if a new key was added
+		bool insert(const IndexT& key, const ValueT& value = ValueT()){
+			return withShard(key, [&](Tree& tree){ return tree.insert(key, value).second; });
+		}
+
+		bool erase(const IndexT& key){
+			return withShard(key, [&](Tree& tree){ return tree.erase(key); });
+		}
+
+		//Returns true and sets value if the key is there
+		bool find(const IndexT& key, ValueT& value){
+			return withShard(key, [&](Tree& tree){
+				auto it = tree.findEqual(key);
+				if (it) value = it.value();
+				return bool(it);
+			});
+		}
+
+		bool exists(const IndexT& key){
+			return withShard(key, [&](Tree& tree){ return tree.exists(key); });
+		}
+
+		//Calls f(key, value) for every key in the range, in order, across shard boundaries.
+		//Each shard is locked while its part is visited, f must not call back into this map.
+		template<class F>
+		void forEach(const Range<IndexT>& range, F f){
+			shared_lock<shared_mutex> guard(boundaries);
+			size_t first = range.l_type ? shardOf(range.l_val) : 0;
+			size_t last = range.r_type ? shardOf(range.r_val) : shards.size() - 1;
+			for (size_t i = first; i <= last; i++){
+				Shard& shard = *shards[i];
+				lock_guard<mutex> shardGuard(shard.lock);
+				auto it = range.l_type == 0 ? shard.tree.begin() :
+					range.l_type == 1 ? shard.tree.findGreaterEqual(range.l_val) : shard.tree.findGreater(range.l_val);
+				for (; it; ++it){
+					if (range.r_type == 1 && smaller(range.r_val, it.key())) break;
+					if (range.r_type == 2 && !smaller(it.key(), range.r_val)) break;
+					f(it.key(), it.value());
+				}
+			}
+		}
+
+		//Aggregate of the values whose keys lie in the range, across shard boundaries
+		ValueT sum(const Range<IndexT>& range){
+			shared_lock<shared_mutex> guard(boundaries);
+			size_t first = range.l_type ? shardOf(range.l_val) : 0;
+			size_t last = range.r_type ? shardOf(range.r_val) : shards.size() - 1;
+			ValueT result = ValueT();
+			bool any = false;
+			for (size_t i = first; i <= last; i++){
+				Shard& shard = *shards[i];
+				lock_guard<mutex> shardGuard(shard.lock);
+				ValueT part;
+				if (!shard.tree.sum(range, part)) continue;
+				result = any ? add(result, part) : part;
+				any = true;
+			}
+			return result;
+		}
+
+	};
+}
+
+#endif
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
 namespace gtree {
 
 	struct Void {
@@ -8,19 +14,39 @@ namespace gtree {
 		}
 	};
 
+	// Leaves values, cumulative values and other updates alike untouched.
+	// A single template, so that ValueT and CumulativeValueT may be the same type.
 	template<class ValueT, class CumulativeValueT>
 	struct NoUpdate {
-		NoUpdate operator+ (const NoUpdate& d) const {
-			return *this;
-		}
-		ValueT operator+ (const ValueT& d) const {
-			return d;
-		}
-		CumulativeValueT operator+ (const CumulativeValueT& d) const {
+		template<class T>
+		T operator+ (const T& d) const {
 			return d;
 		}
 	};
 
+	// Pending lazy update of a node. NoUpdate changes nothing, so it is not stored:
+	// a static member stands in for it and enabled lets the pushing down be skipped.
+	template<class UpdateT>
+	struct _gtree_update {
+		static const bool enabled = true;
+
+		UpdateT update;
+
+		explicit _gtree_update(const UpdateT& init) : update(init) {}
+	};
+
+	template<class ValueT, class CumulativeValueT>
+	struct _gtree_update<NoUpdate<ValueT, CumulativeValueT>> {
+		static const bool enabled = false;
+
+		static NoUpdate<ValueT, CumulativeValueT> update;
+
+		explicit _gtree_update(const NoUpdate<ValueT, CumulativeValueT>&) {}
+	};
+
+	template<class ValueT, class CumulativeValueT>
+	NoUpdate<ValueT, CumulativeValueT> _gtree_update<NoUpdate<ValueT, CumulativeValueT>>::update;
+
 	template<class T1, class T2, class Result>
 	struct _gtree_plus {
 		Result operator() (const T1& a, const T2& b) const {
@@ -28,6 +54,227 @@ namespace gtree {
 		}
 	};
 
+	// Number of nodes in a subtree, only stored when order statistics are enabled.
+	// The disabled version is empty, so nodes deriving from it do not grow.
+	template<bool enabled>
+	struct _gtree_size {
+		size_t subtreeSize;
+
+		_gtree_size() : subtreeSize(1) {}
+
+		size_t getSize() const {
+			return subtreeSize;
+		}
+
+		void setSize(size_t size) {
+			subtreeSize = size;
+		}
+	};
+
+	template<>
+	struct _gtree_size<false> {
+		size_t getSize() const {
+			return 0;
+		}
+
+		void setSize(size_t) {}
+	};
+
+	// Value of a node and the aggregate of its subtree.
+	// Void values (sets) store neither: static members stand in for them, so the code reading
+	// and writing them stays the same while nodes do not grow, and enabled lets repairs skip them.
+	template<class ValueT, class = void>
+	struct _gtree_value {
+		static const bool enabled = true;
+
+		ValueT value, totalValue;
+
+		template<class... Args>
+		explicit _gtree_value(Args&&... valueInit) : value(std::forward<Args>(valueInit)...), totalValue(value) {}
+	};
+
+	template<class Unused>
+	struct _gtree_value<Void, Unused> {
+		static const bool enabled = false;
+
+		static Void value, totalValue;
+
+		template<class... Args>
+		explicit _gtree_value(Args&&...) {}
+	};
+
+	template<class Unused>
+	Void _gtree_value<Void, Unused>::value;
+
+	template<class Unused>
+	Void _gtree_value<Void, Unused>::totalValue;
+
+	template<class T>
+	struct _gtree_void {
+		typedef void type;
+	};
+
+	// Copy of the start of the key kept inside the node, only when the comparator
+	// defines Prefix and Probe types (see PrefixLess). A search makes a Probe out of the key
+	// once and compares it with the nodes' prefixes, the keys themselves are only read on a tie.
+	// The disabled version is empty and leaves the comparisons to the comparator.
+	template<class Comp, class = void>
+	struct _gtree_prefix {
+		static const bool enabled = false;
+
+		struct Probe {
+			template<class K>
+			explicit Probe(const K&) {}
+		};
+
+		template<class K>
+		void setPrefix(const K&) {}
+
+		template<class K>
+		int comparePrefix(const Probe&, const K&) const {
+			return 0;
+		}
+	};
+
+	template<class Comp>
+	struct _gtree_prefix<Comp, typename _gtree_void<typename Comp::Prefix>::type> {
+		static const bool enabled = true;
+
+		typedef typename Comp::Probe Probe;
+
+		typename Comp::Prefix prefix;
+
+		template<class K>
+		void setPrefix(const K& key) {
+			prefix = typename Comp::Prefix(key);
+		}
+
+		// negative if the probed key comes first, the key is that of the node
+		template<class K>
+		int comparePrefix(const Probe& probe, const K& key) const {
+			return probe.compare(prefix, key);
+		}
+	};
+
+	// Byte-wise (memcmp) order of strings, the same as less<string>. Transparent, so trees using it
+	// can be searched for with const char* or string_view without building a key.
+	// Nodes keep the first 8 * Words bytes of their keys, packed into integers that compare
+	// like the bytes do, so most steps of a search do not touch the key's own buffer.
+	// Keys may be of any type with data() and size().
+	template<size_t Words = 2>
+	struct PrefixLess {
+		typedef void is_transparent;
+
+		template<class S, class = typename std::enable_if<std::is_class<S>::value>::type>
+		static std::pair<const char*, size_t> chars(const S& s) {
+			return std::make_pair(s.data(), size_t(s.size()));
+		}
+
+		static std::pair<const char*, size_t> chars(const char* s) {
+			return std::make_pair(s, std::strlen(s));
+		}
+
+		static int compare(const char* a, size_t n, const char* b, size_t m) {
+			size_t k = n < m ? n : m;
+			int c = k ? std::memcmp(a, b, k) : 0;
+			if (c) return c;
+			return n < m ? -1 : n > m ? 1 : 0;
+		}
+
+		struct Prefix {
+			uint64_t word[Words];
+
+			Prefix() : word() {}
+
+			// zero padded, a key that ends early ties with the longer ones it starts
+			template<class K>
+			explicit Prefix(const K& key) : word() {
+				std::pair<const char*, size_t> s = chars(key);
+				size_t n = s.second < 8 * Words ? s.second : 8 * Words;
+				for (size_t i = 0; i < n; i++) {
+					word[i / 8] |= uint64_t((unsigned char)s.first[i]) << (56 - 8 * (i % 8));
+				}
+			}
+		};
+
+		// the searched key, measured once
+		struct Probe : Prefix {
+			std::pair<const char*, size_t> key;
+
+			template<class K>
+			explicit Probe(const K& _key) : Prefix(_key), key(chars(_key)) {}
+
+			template<class K>
+			int compare(const Prefix& prefix, const K& other) const {
+				for (size_t i = 0; i < Words; i++) {
+					if (this->word[i] != prefix.word[i]) return this->word[i] < prefix.word[i] ? -1 : 1;
+				}
+				// equal prefixes, so the bytes both keys have within them are equal too
+				std::pair<const char*, size_t> s = chars(other);
+				size_t skip = 8 * Words;
+				if (skip > key.second) skip = key.second;
+				if (skip > s.second) skip = s.second;
+				return PrefixLess::compare(key.first + skip, key.second - skip, s.first + skip, s.second - skip);
+			}
+		};
+
+		template<class A, class B>
+		bool operator() (const A& a, const B& b) const {
+			std::pair<const char*, size_t> x = chars(a), y = chars(b);
+			return compare(x.first, x.second, y.first, y.second) < 0;
+		}
+	};
+
+	// Splay policies decide whether a read (lookup, find, iteration step) splays the node it reached.
+	// They are called with the depth of that node, which is only computed if usesDepth is set.
+	// Writes always splay.
+
+	// Classic splay tree, every access moves the node to the root
+	struct SplayAlways {
+		static const bool usesDepth = false;
+
+		bool operator() (size_t) {
+			return true;
+		}
+	};
+
+	// Reads leave the tree untouched, the shape only changes on writes
+	struct SplayNever {
+		static const bool usesDepth = false;
+
+		bool operator() (size_t) {
+			return false;
+		}
+	};
+
+	// Splays only nodes found deeper than the threshold, shallow hits stay where they are
+	template<size_t Threshold>
+	struct SplayDeeperThan {
+		static const bool usesDepth = true;
+
+		bool operator() (size_t depth) {
+			return depth > Threshold;
+		}
+	};
+
+	// Splays with the given probability, in percent (randomized splaying)
+	template<unsigned Percent>
+	struct SplayRandomly {
+		static const bool usesDepth = false;
+
+		unsigned state;
+
+		SplayRandomly() : state(2463534242u) {}
+
+		bool operator() (size_t) {
+			// xorshift32
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return state % 100 < Percent;
+		}
+	};
+
 	template<class IndexT>
 	struct Range {
 		// 0 - no bound; 1 - inclusive; 2 - exclusive
@@ -1,9 +1,26 @@
 #include "GTree.h"
 #include "GTreeLazy.h"
+#include "GTreeCompact.h"
+#include "GTreeTopDown.h"
+#include "GTreePersistent.h"
+#include "GTreeCombining.h"
+#include "ShardedGTree.h"
 #include <ctime>
+#include <chrono>
 #include <iostream>
 #include <algorithm>
 #include <string>
+#include <set>
+#include <map>
+#include <list>
+#include <cstdlib>
+#include <climits>
+#include <vector>
+#include <thread>
+#include <mutex>
+#if __cplusplus >= 201703L
+#include <memory_resource>
+#endif
 using namespace gtree;
 using namespace std;
 
@@ -69,15 +86,2033 @@ void print(int a[], int n){
 	cout << a[i] << endl;
 }
 
+//wall time, so that benchmarks running several threads are not charged for each of them
 void timeTest(void (*f)()){
-	int t = clock();
+	auto t = chrono::steady_clock::now();
 	f();
-	double passed = clock() - t;
-	cout << passed / CLOCKS_PER_SEC << " seconds" << endl;
+	chrono::duration<double> passed = chrono::steady_clock::now() - t;
+	cout << passed.count() << " seconds" << endl;
 }
 
-int main(){
+void testPool(int n){
+	GTree<int, long long> drvo;
+	set<int> check;
+	srand(12345);
+	for (int round = 0; round < 3; round++){
+		for (int i = 0; i < n; i++){
+			int x = rand() % n;
+			if (rand() % 3){
+				drvo.insert(x, x);
+				check.insert(x);
+			}
+			else {
+				drvo.erase(x);
+				check.erase(x);
+			}
+		}
+		GTree<int, long long> copy(drvo);
+		drvo.clear();
+		drvo = copy;
+	}
+	bool ok = true;
+	auto it = drvo.begin();
+	for (int x : check){
+		if (!it || it.key() != x || it.value() != x) ok = false;
+		if (it) ++it;
+	}
+	cout << "Pool churn " << (ok && !it ? "OK" : "FAILED") << endl;
+}
+
+//Stateful allocator, every instance counts into its own counter
+template<class T>
+struct CountingAllocator {
+	typedef T value_type;
+	size_t* counter;
+
+	CountingAllocator(size_t* counter) : counter(counter) {}
+
+	template<class U>
+	CountingAllocator(const CountingAllocator<U>& other) : counter(other.counter) {}
+
+	T* allocate(size_t n){
+		++*counter;
+		return allocator<T>().allocate(n);
+	}
+
+	void deallocate(T* p, size_t n){
+		allocator<T>().deallocate(p, n);
+	}
+
+	template<class U>
+	bool operator==(const CountingAllocator<U>& other)const{
+		return counter == other.counter;
+	}
+
+	template<class U>
+	bool operator!=(const CountingAllocator<U>& other)const{
+		return counter != other.counter;
+	}
+};
+
+void testAllocator(){
+	typedef CountingAllocator<pair<const int, int>> Counting;
+	size_t first = 0, second = 0;
+	GTree<int, int, less<int>, plus<int>, Counting> drvo((Counting(&first)));
+	for (int i = 0; i < 1000; i++) drvo.insert(i, i);
+	GTree<int, int, less<int>, plus<int>, Counting> copy(drvo, Counting(&second));
+	size_t firstBefore = first;
+	copy.insert(1000, 1000);
+	bool ok = first > 0 && second > 0 && first == firstBefore && copy.get_allocator().counter == &second;
+#if __cplusplus >= 201703L
+	{
+		char buffer[1 << 16];
+		pmr::monotonic_buffer_resource arena(buffer, sizeof buffer, pmr::null_memory_resource());
+		GTree<int, int, less<int>, plus<int>, pmr::polymorphic_allocator<pair<const int, int>>> local(&arena);
+		for (int i = 0; i < 1000; i++) local.insert(i, i);
+		ok = ok && local.exists(500);
+	}
+#endif
+	cout << "Allocator " << (ok ? "OK" : "FAILED") << endl;
+}
+
+void testCompact(int n){
+	GTreeCompact<int, long long> drvo;
+	map<int, long long> check;
+	srand(777);
+	bool ok = true;
+	for (int i = 0; i < n; i++){
+		int x = rand() % n;
+		switch (rand() % 4){
+		case 0:
+			ok = ok && drvo.erase(x) == (check.erase(x) > 0);
+			break;
+		case 1:
+			ok = ok && drvo.findGreaterEqual(x) == drvo.findEqual(check.lower_bound(x) == check.end() ? -1 : check.lower_bound(x)->first);
+			break;
+		default:
+			drvo.insert(x, i);
+			check[x] = i;
+		}
+	}
+	auto it = drvo.begin();
+	for (auto& kv : check){
+		if (!it || it.key() != kv.first || it.value() != kv.second) ok = false;
+		if (it) ++it;
+	}
+	cout << "Compact layout " << (ok && !it ? "OK" : "FAILED") << endl;
+}
+
+struct Max {
+	int operator()(int a, int b)const{
+		return max(a, b);
+	}
+};
+
+void testTopDown(int n){
+	//values with a max aggregate and lazy "add to range" updates
+	GTreeTopDown<int, int, int, int, less<int>, Max> drvo;
+	map<int, int> check;
+	srand(4242);
+	bool ok = true;
+	for (int i = 0; i < n; i++){
+		int a = rand() % n, b = rand() % n;
+		if (b < a) swap(a, b);
+		Range<int> range(1, a, 2, b);
+		switch (rand() % 6){
+		case 0:
+			ok = ok && drvo.erase(a) == (check.erase(a) > 0);
+			break;
+		case 1: {
+			int u = rand() % 10;
+			drvo.updateRange(range, u);
+			for (auto it = check.lower_bound(a); it != check.lower_bound(b); ++it) it->second += u;
+			break;
+		}
+		case 2: {
+			int expected = 0;
+			for (auto it = check.lower_bound(a); it != check.lower_bound(b); ++it) expected = max(expected, it->second);
+			ok = ok && drvo.sum(range) == expected;
+			break;
+		}
+		case 3: {
+			auto it = check.upper_bound(a);
+			auto found = drvo.findGreater(a);
+			ok = ok && (it == check.end() ? !found : found && found.key() == it->first && found.value() == it->second);
+			break;
+		}
+		default:
+			drvo.insert(a, i);
+			check[a] = i;
+		}
+	}
+	GTreeTopDown<int, int, int, int, less<int>, Max> copy(drvo);
+	auto it = copy.begin();
+	for (auto& kv : check){
+		if (!it || it.key() != kv.first || it.value() != kv.second) ok = false;
+		if (it) ++it;
+	}
+	cout << "Top-down splay " << (ok && !it ? "OK" : "FAILED") << endl;
+}
+
+void testBuild(int n){
+	vector<pair<int, long long>> sorted, shuffled;
+	for (int i = 0; i < n; i++) sorted.push_back(make_pair(2 * i, i));
+	shuffled = sorted;
+	for (int i = n - 1; i > 0; i--) swap(shuffled[i], shuffled[rand() % (i + 1)]);
+	shuffled.push_back(make_pair(0, -1)); //the later duplicate wins
+	GTree<int, long long> fromSorted(sorted.begin(), sorted.end());
+	GTree<int, long long> fromShuffled(shuffled.begin(), shuffled.end());
+	bool ok = fromShuffled[0] == -1;
+	fromShuffled.insert(0, 0);
+	auto a = fromSorted.begin(), b = fromShuffled.begin();
+	for (int i = 0; i < n; i++){
+		if (!a || !b || a.key() != 2 * i || b.key() != 2 * i || a.value() != i || b.value() != i) ok = false;
+		if (a) ++a;
+		if (b) ++b;
+	}
+	ok = ok && !a && !b && fromSorted.exists(2 * (n - 1)) && !fromSorted.exists(1);
+	cout << "Bulk build " << (ok ? "OK" : "FAILED") << endl;
+}
+
+void testInsertBatch(int n){
+	GTree<int, long long> drvo;
+	map<int, long long> check;
+	srand(99);
+	bool ok = true;
+	for (int round = 0; round < 20; round++){
+		vector<pair<int, long long>> batch;
+		int k = rand() % n + 1;
+		for (int i = 0; i < k; i++) batch.push_back(make_pair(rand() % (4 * n), round * n + i));
+		size_t before = check.size();
+		for (auto& kv : batch) check[kv.first] = kv.second;
+		ok = ok && drvo.insertBatch(batch) == check.size() - before;
+		drvo.erase(batch[0].first);
+		check.erase(batch[0].first);
+	}
+	auto it = drvo.begin();
+	for (auto& kv : check){
+		if (!it || it.key() != kv.first || it.value() != kv.second) ok = false;
+		if (it) ++it;
+	}
+	cout << "Batch insert " << (ok && !it ? "OK" : "FAILED") << endl;
+}
+
+void testOrderStatistics(int n){
+	GTree<int, int, less<int>, plus<int>, allocator<pair<const int, int>>, true> drvo;
+	set<int> check;
+	srand(31337);
+	bool ok = true;
+	for (int i = 0; i < n; i++){
+		int a = rand() % n, b = rand() % n;
+		switch (rand() % 5){
+		case 0:
+			drvo.erase(a);
+			check.erase(a);
+			break;
+		case 1:
+			ok = ok && drvo.rank(a) == size_t(distance(check.begin(), check.lower_bound(a)));
+			break;
+		case 2: {
+			size_t k = check.empty() ? 0 : a % check.size();
+			auto it = drvo.kth(k);
+			ok = ok && (check.empty() ? !it : it && it.key() == *next(check.begin(), k));
+			break;
+		}
+		case 3: {
+			if (b < a) swap(a, b);
+			size_t expected = distance(check.upper_bound(a), check.upper_bound(b));
+			ok = ok && drvo.countRange(Range<int>(2, a, 1, b)) == expected;
+			break;
+		}
+		default:
+			drvo.insert(a, a);
+			check.insert(a);
+		}
+		ok = ok && drvo.size() == check.size();
+	}
+	cout << "Order statistics " << (ok ? "OK" : "FAILED") << endl;
+}
+
+void testSum(int n){
+	GTree<int, long long> drvo;
+	map<int, long long> check;
+	srand(2718);
+	bool ok = true;
+	for (int i = 0; i < n; i++){
+		int a = rand() % n, b = rand() % n;
+		if (b < a) swap(a, b);
+		switch (rand() % 6){
+		case 0:
+			drvo.erase(a);
+			check.erase(a);
+			break;
+		case 1: {
+			long long expected = 0;
+			for (auto it = check.upper_bound(a); it != check.lower_bound(b); ++it) expected += it->second;
+			ok = ok && drvo.sum(Range<int>(2, a, 2, b)) == expected;
+			long long part = -1;
+			bool any = check.upper_bound(a) != check.lower_bound(b);
+			ok = ok && drvo.sum(Range<int>(2, a, 2, b), part) == any && part == (any ? expected : -1);
+			break;
+		}
+		case 2: {
+			long long expected = 0;
+			for (auto it = check.begin(); it != check.upper_bound(a); ++it) expected += it->second;
+			ok = ok && drvo.sumPrefix(a) == expected;
+			break;
+		}
+		case 3: {
+			long long expected = 0;
+			for (auto it = check.upper_bound(a); it != check.end(); ++it) expected += it->second;
+			ok = ok && drvo.sumSuffix(a, false) == expected;
+			break;
+		}
+		default:
+			drvo.insert(a, i);
+			check[a] = i;
+		}
+	}
+	cout << "Range sum " << (ok ? "OK" : "FAILED") << endl;
+}
+
+template<class Policy>
+bool checkSplayPolicy(int n){
+	GTree<int, long long, less<int>, plus<long long>, allocator<pair<const int, long long>>, true, Policy> drvo;
+	map<int, long long> check;
+	srand(4711);
+	bool ok = true;
+	for (int i = 0; i < n; i++){
+		int a = rand() % n;
+		switch (rand() % 6){
+		case 0:
+			ok = ok && drvo.erase(a) == (check.erase(a) > 0);
+			break;
+		case 1:
+			ok = ok && drvo.exists(a) == (check.count(a) > 0) && drvo[a] == (check.count(a) ? check[a] : 0);
+			break;
+		case 2: {
+			auto it = check.upper_bound(a);
+			auto found = drvo.findGreater(a);
+			ok = ok && (it == check.end() ? !found : found && found.key() == it->first);
+			break;
+		}
+		case 3:
+			ok = ok && drvo.rank(a) == size_t(distance(check.begin(), check.lower_bound(a)));
+			break;
+		default:
+			drvo.insert(a, i);
+			check[a] = i;
+		}
+	}
+	auto it = drvo.begin();
+	for (auto& kv : check){
+		if (!it || it.key() != kv.first || it.value() != kv.second) ok = false;
+		if (it) ++it;
+	}
+	auto back = drvo.end();
+	for (auto kv = check.rbegin(); kv != check.rend(); ++kv){
+		if (!back || back.key() != kv->first) ok = false;
+		if (back) --back;
+	}
+	return ok && !it && !back;
+}
+
+void testSplayPolicies(int n){
+	bool ok = checkSplayPolicy<SplayAlways>(n) && checkSplayPolicy<SplayNever>(n) &&
+		checkSplayPolicy<SplayDeeperThan<8>>(n) && checkSplayPolicy<SplayRandomly<25>>(n);
+	cout << "Splay policies " << (ok ? "OK" : "FAILED") << endl;
+}
+
+//readers on several threads share one snapshot while the tree keeps changing
+void testSnapshot(int n){
+	GTree<int, long long> drvo;
+	map<int, long long> check;
+	srand(161);
+	for (int i = 0; i < n; i++){
+		int a = rand() % (4 * n);
+		drvo.insert(a, i);
+		check[a] = i;
+	}
+	const GTree<int, long long>::Snapshot snapshot = drvo.freeze();
+	for (int i = 0; i < n; i++) drvo.erase(rand() % (4 * n));
+	bool ok = snapshot.size() == check.size();
+	auto it = snapshot.begin();
+	for (auto& kv : check){
+		if (!it || it.key() != kv.first || it.value() != kv.second) ok = false;
+		if (it) ++it;
+	}
+	auto back = snapshot.end();
+	for (auto kv = check.rbegin(); kv != check.rend(); ++kv){
+		if (!back || back.key() != kv->first) ok = false;
+		if (back) --back;
+	}
+	ok = ok && !it && !back;
+	bool okThread[4];
+	vector<thread> readers;
+	for (int t = 0; t < 4; t++) readers.push_back(thread([&, t](){
+		bool good = true;
+		long long sum = 0;
+		auto kv = check.begin();
+		for (int a = -1; a <= 4 * n; a++){
+			while (kv != check.end() && kv->first <= a) sum += (kv++)->second;
+			auto ge = check.lower_bound(a), gt = check.upper_bound(a);
+			auto eq = snapshot.findEqual(a), fge = snapshot.findGreaterEqual(a), fgt = snapshot.findGreater(a);
+			auto fle = snapshot.findSmallerEqual(a), flt = snapshot.findSmaller(a);
+			good = good && (ge != check.end() && ge->first == a ? eq && eq.value() == ge->second : !eq);
+			good = good && (ge == check.end() ? !fge : fge && fge.key() == ge->first);
+			good = good && (gt == check.end() ? !fgt : fgt && fgt.key() == gt->first);
+			good = good && (gt == check.begin() ? !fle : fle && fle.key() == prev(gt)->first);
+			good = good && (ge == check.begin() ? !flt : flt && flt.key() == prev(ge)->first);
+			good = good && snapshot.sumPrefix(a) == sum && snapshot.exists(a) == (ge != check.end() && ge->first == a);
+		}
+		okThread[t] = good;
+	}));
+	for (auto& reader : readers) reader.join();
+	for (int t = 0; t < 4; t++) ok = ok && okThread[t];
+	cout << "Snapshot " << (ok ? "OK" : "FAILED") << endl;
+}
+
+template<int operation>
+bool checkSetOperation(int n, unsigned threads){
+	GTree<int, long long> a, b;
+	map<int, long long> ca, cb;
+	for (int i = 0; i < n; i++){
+		int x = rand() % (2 * n), y = rand() % (2 * n);
+		a.insert(x, x);
+		ca[x] = x;
+		b.insert(y, 1);
+		cb[y] = 1;
+	}
+	if (operation == 0){
+		a.unionWith(move(b), threads);
+		for (auto& kv : cb) ca[kv.first] += kv.second;
+	}
+	else if (operation == 1){
+		a.intersectWith(move(b), threads);
+		map<int, long long> both;
+		for (auto& kv : cb) if (ca.count(kv.first)) both[kv.first] = ca[kv.first] + kv.second;
+		ca = both;
+	}
+	else {
+		a.differenceWith(move(b), threads);
+		for (auto& kv : cb) ca.erase(kv.first);
+	}
+	bool ok = b.empty();
+	long long sum = 0;
+	auto it = a.begin();
+	for (auto& kv : ca){
+		if (!it || it.key() != kv.first || it.value() != kv.second) ok = false;
+		if (it) ++it;
+		sum += kv.second;
+	}
+	return ok && !it && a.sum(Range<int>(0, 0, 0, 0)) == sum;
+}
+
+void testSetOperations(int n){
+	srand(8080);
+	bool ok = true;
+	for (unsigned threads = 1; threads <= 4; threads *= 4){
+		ok = ok && checkSetOperation<0>(n, threads) && checkSetOperation<1>(n, threads) && checkSetOperation<2>(n, threads);
+	}
+	ok = ok && checkSetOperation<0>(10, 4) && checkSetOperation<1>(10, 4) && checkSetOperation<2>(10, 4);
+	cout << "Set operations " << (ok ? "OK" : "FAILED") << endl;
+}
+
+//every few steps a version is kept, all of them must still read as they were
+void testPersistent(int n){
+	GTreePersistent<int, long long> drvo;
+	map<int, long long> check;
+	vector<GTreePersistent<int, long long>> versions;
+	vector<map<int, long long>> checks;
+	srand(5150);
+	bool ok = true;
+	for (int i = 0; i < n; i++){
+		int a = rand() % n;
+		if (rand() % 3 == 0){
+			ok = ok && drvo.erase(a) == (check.erase(a) > 0);
+		}
+		else {
+			ok = ok && drvo.insert(a, i) == (check.count(a) == 0);
+			check[a] = i;
+		}
+		if (i % 500 == 0){
+			versions.push_back(drvo);
+			checks.push_back(check);
+		}
+		if (i % 1500 == 0 && versions.size() > 2){
+			versions.erase(versions.begin() + 1);
+			checks.erase(checks.begin() + 1);
+		}
+	}
+	versions.push_back(drvo);
+	checks.push_back(check);
+	for (size_t v = 0; v < versions.size(); v++){
+		GTreePersistent<int, long long>& version = versions[v];
+		map<int, long long>& expected = checks[v];
+		auto it = version.begin();
+		for (auto& kv : expected){
+			if (!it || it.key() != kv.first || it.value() != kv.second) ok = false;
+			if (it) ++it;
+		}
+		auto back = version.end();
+		for (auto kv = expected.rbegin(); kv != expected.rend(); ++kv){
+			if (!back || back.key() != kv->first) ok = false;
+			if (back) --back;
+		}
+		ok = ok && !it && !back;
+		for (int q = 0; q < 100; q++){
+			int a = rand() % n, b = rand() % n;
+			if (b < a) swap(a, b);
+			long long sum = 0;
+			for (auto kv = expected.upper_bound(a); kv != expected.upper_bound(b); ++kv) sum += kv->second;
+			auto ge = expected.lower_bound(a);
+			auto found = version.findGreaterEqual(a), smaller = version.findSmaller(a);
+			ok = ok && version.sum(Range<int>(2, a, 1, b)) == sum && version.exists(a) == (expected.count(a) > 0);
+			ok = ok && (ge == expected.end() ? !found : found && found.key() == ge->first);
+			ok = ok && (ge == expected.begin() ? !smaller : smaller && smaller.key() == prev(ge)->first);
+		}
+	}
+	cout << "Persistent versions " << (ok ? "OK" : "FAILED") << endl;
+}
+
+//each thread works on its own keys, so it can check its results against a private map
+void testCombining(int n){
+	GTreeCombining<int, long long> drvo(3);
+	const int threads = 4;
+	map<int, long long> checks[threads];
+	bool okThread[threads];
+	vector<thread> workers;
+	for (int t = 0; t < threads; t++) workers.push_back(thread([&, t](){
+		map<int, long long>& check = checks[t];
+		unsigned state = 12345 + t;
+		bool good = true;
+		for (int i = 0; i < n; i++){
+			state = state * 1103515245u + 12345u;
+			int a = int((state >> 8) % unsigned(n)) * threads + t;
+			long long value = 0;
+			switch ((state >> 4) % 4){
+			case 0:
+				good = good && drvo.erase(a) == (check.erase(a) > 0);
+				break;
+			case 1:
+				good = good && drvo.find(a, value) == (check.count(a) > 0) && (!check.count(a) || value == check[a]);
+				break;
+			default:
+				good = good && drvo.insert(a, i) == (check.count(a) == 0);
+				check[a] = i;
+			}
+		}
+		okThread[t] = good;
+	}));
+	for (auto& worker : workers) worker.join();
+	bool ok = true;
+	long long total = 0;
+	for (int t = 0; t < threads; t++){
+		ok = ok && okThread[t];
+		for (auto& kv : checks[t]){
+			long long value;
+			ok = ok && drvo.find(kv.first, value) && value == kv.second;
+			total += kv.second;
+		}
+	}
+	ok = ok && drvo.sum(Range<int>(0, 0, 0, 0)) == total;
+	cout << "Flat combining " << (ok ? "OK" : "FAILED") << endl;
+}
+
+void testSplitConcat(int n){
+	typedef GTree<int, long long, less<int>, plus<long long>, allocator<pair<const int, long long>>, true> Tree;
+	Tree drvo;
+	map<int, long long> check;
+	srand(777);
+	for (int i = 0; i < n; i++){
+		int a = rand() % (4 * n);
+		drvo.insert(a, a);
+		check[a] = a;
+	}
+	bool ok = true;
+	//cut into pieces and glue them back together, the pieces keep working on their own
+	vector<int> cuts;
+	vector<Tree> pieces;
+	for (int cut = 4 * n; cut > 0; cut -= n / 2){
+		cuts.push_back(cut);
+		pieces.push_back(drvo.split(cut));
+	}
+	cuts.push_back(INT_MIN);
+	pieces.push_back(move(drvo));
+	for (size_t i = 0; i < pieces.size(); i++){
+		long long sum = 0;
+		for (auto kv = check.lower_bound(cuts[i]); kv != check.end() && (i == 0 || kv->first < cuts[i - 1]); ++kv) sum += kv->second;
+		ok = ok && pieces[i].sum(Range<int>(0, 0, 0, 0)) == sum;
+		pieces[i].insert(cuts[i], 1);
+		pieces[i].erase(cuts[i]);
+		if (check.count(cuts[i])) pieces[i].insert(cuts[i], cuts[i]);
+	}
+	Tree whole;
+	for (size_t i = pieces.size(); i-- > 0;) whole.concat(pieces[i]);
+	auto it = whole.begin();
+	for (auto& kv : check){
+		if (!it || it.key() != kv.first || it.value() != kv.second) ok = false;
+		if (it) ++it;
+	}
+	ok = ok && !it && whole.size() == check.size();
+	for (int i = 0; i < n; i++){
+		int a = rand() % (4 * n);
+		whole.erase(a);
+		check.erase(a);
+	}
+	ok = ok && whole.size() == check.size() && whole.rank(2 * n) == size_t(distance(check.begin(), check.lower_bound(2 * n)));
+#if __cplusplus >= 201703L
+	//different resources, so the nodes have to be copied over
+	pmr::unsynchronized_pool_resource first, second;
+	GTree<int, int, less<int>, plus<int>, pmr::polymorphic_allocator<pair<const int, int>>> a(&first), b(&second);
+	for (int i = 0; i < 100; i++) a.insert(i, i), b.insert(100 + i, i);
+	a.concat(b);
+	ok = ok && b.empty() && a.exists(150) && a.sum(Range<int>(1, 0, 1, 199)) == 2 * 4950;
+#endif
+	cout << "Split and concat " << (ok ? "OK" : "FAILED") << endl;
+}
+
+//threads on disjoint keys, rebalanced often, so shards get split and moved under them
+void testSharded(int n){
+	ShardedGTree<int, long long> drvo(8, 500);
+	const int threads = 4;
+	map<int, long long> checks[threads];
+	bool okThread[threads];
+	vector<thread> workers;
+	for (int t = 0; t < threads; t++) workers.push_back(thread([&, t](){
+		map<int, long long>& check = checks[t];
+		unsigned state = 4321 + t;
+		bool good = true;
+		for (int i = 0; i < n; i++){
+			state = state * 1103515245u + 12345u;
+			int a = int((state >> 8) % unsigned(n)) * threads + t;
+			long long value = 0;
+			switch ((state >> 4) % 4){
+			case 0:
+				good = good && drvo.erase(a) == (check.erase(a) > 0);
+				break;
+			case 1:
+				good = good && drvo.find(a, value) == (check.count(a) > 0) && (!check.count(a) || value == check[a]);
+				break;
+			default:
+				good = good && drvo.insert(a, i) == (check.count(a) == 0);
+				check[a] = i;
+			}
+		}
+		okThread[t] = good;
+	}));
+	for (auto& worker : workers) worker.join();
+	bool ok = drvo.shardCount() == 8;
+	map<int, long long> all;
+	for (int t = 0; t < threads; t++){
+		ok = ok && okThread[t];
+		all.insert(checks[t].begin(), checks[t].end());
+	}
+	ok = ok && drvo.size() == all.size();
+	auto kv = all.lower_bound(n);
+	long long sum = 0;
+	drvo.forEach(Range<int>(1, n, 2, 3 * n), [&](int key, long long value){
+		ok = ok && kv != all.end() && kv->first == key && kv->second == value;
+		sum += value;
+		++kv;
+	});
+	ok = ok && (kv == all.end() || kv->first >= 3 * n) && drvo.sum(Range<int>(1, n, 2, 3 * n)) == sum;
+	cout << "Sharded map " << (ok ? "OK" : "FAILED") << endl;
+}
+
+//the keys slide upwards, so shards keep handing keys on and the lowest ones only lose keys;
+//the pools must not grow with the rounds. Also splits off half a tree and lets it die,
+//its free slots have to be reused by the tree left.
+void testShardedMemory(int n){
+	ShardedGTree<int, int> drvo(4, 1000);
+	size_t warm = 0;
+	for (int round = 0; round < 40; round++){
+		for (int i = 0; i < n; i++){
+			drvo.insert(round * n + i, i);
+			if (round > 1) drvo.erase((round - 2) * n + i);
+		}
+		if (round == 9) warm = drvo.memoryUsage();
+	}
+	bool ok = warm > 0 && drvo.memoryUsage() <= warm * 2 && drvo.size() == size_t(2 * n);
+	GTree<int, int> drvo2;
+	for (int i = 0; i < n; i++) drvo2.insert(i, i);
+	size_t before = drvo2.memoryUsage();
+	for (int round = 0; round < 20; round++){
+		drvo2.splitAt(n / 2);
+		for (int i = n / 2; i < n; i++) drvo2.insert(i, i);
+	}
+	ok = ok && drvo2.exists(n - 1) && drvo2.memoryUsage() == before;
+	cout << "Sharded memory " << (ok ? "OK" : "FAILED") << endl;
+}
+
+//moves string keys between two trees with extract, checks that no node was reallocated
+void testNodeHandles(int n){
+	typedef GTree<string, long long> Tree;
+	Tree first, second;
+	map<string, long long> check;
+	srand(1717);
+	bool ok = true;
+	for (int i = 0; i < n; i++){
+		string key = "key" + to_string(rand() % n);
+		switch (i % 3){
+		case 0:
+			ok = ok && first.emplace(key, i).second == (check.count(key) == 0);
+			check.emplace(key, i);
+			break;
+		case 1:
+			ok = ok && first.try_emplace(key, i).second == (check.count(key) == 0);
+			check.try_emplace(key, i);
+			break;
+		default:
+			ok = ok && first.insert(string(key), (long long)i).second == (check.count(key) == 0);
+			check[key] = i;
+		}
+	}
+	//values written through iterators must show in the sums
+	for (auto it = first.begin(); it; ++it){
+		if (it.value() % 2) it.setValue(it.value() * 3);
+	}
+	for (auto& kv : check){
+		if (kv.second % 2) kv.second *= 3;
+	}
+	long long sum = 0;
+	for (auto& kv : check) sum += kv.second;
+	ok = ok && first.sum(Range<string>(0, "", 0, "")) == sum;
+
+	vector<string> moved;
+	for (auto& kv : check){
+		if (rand() % 2) moved.push_back(kv.first);
+	}
+	for (const string& key : moved){
+		Tree::NodeHandle handle = first.extract(key);
+		long long value = handle.value();
+		auto result = second.insert(move(handle));
+		ok = ok && handle.empty() && result.second && result.first.key() == key && result.first.value() == value && !first.exists(key);
+	}
+	Tree::NodeHandle again = second.extract(moved.empty() ? "" : moved[0]);
+	ok = ok && first.extract("none").empty() && (moved.empty() || !again.empty());
+	if (again){
+		second.insert(again.key(), again.value() + 1);
+		auto result = second.insert(move(again));
+		ok = ok && !result.second && !again.empty() && result.first.key() == moved[0];
+	}
+	auto it = first.begin();
+	auto jt = second.begin();
+	for (auto& kv : check){
+		auto& at = second.exists(kv.first) ? jt : it;
+		long long expected = !moved.empty() && kv.first == moved[0] ? kv.second + 1 : kv.second;
+		ok = ok && at && (*at).first == kv.first && (*at).second == expected;
+		if (at) ++at;
+	}
+	ok = ok && !it && !jt;
+
+	//handles outlive whatever happens to the tree they came from
+	auto name = [](int i){ return "handle-key-past-the-small-string-buffer-" + to_string(i); };
+	Reclaimer reclaimer;
+	Tree target;
+	{
+		Tree source;
+		for (int i = 0; i < 100; i++) source.insert(name(i), i);
+		Tree::NodeHandle cleared = source.extract(name(1));
+		source.clear();
+		ok = ok && source.insert(move(cleared)).second && source.exists(name(1));
+		Tree::NodeHandle assigned = source.extract(name(1));
+		source = Tree(first);
+		ok = ok && source.insert(move(assigned)).second && source[name(1)] == 1;
+		source.reclaimInBackground(&reclaimer);
+		Tree::NodeHandle reclaimed = source.extract(name(1));
+		source.clear();
+		reclaimer.wait();
+		ok = ok && target.insert(move(reclaimed)).second;
+		source.insert(name(3), 3);
+		Tree::NodeHandle destroyed = source.extract(name(3));
+		{
+			Tree gone(move(source));
+		}
+		ok = ok && target.insert(move(destroyed)).second;
+		Tree dropping;
+		dropping.insert(name(4), 4);
+		Tree::NodeHandle dropped = dropping.extract(name(4));
+		dropping = Tree();
+		ok = ok && dropped.value() == 4;
+	}
+	ok = ok && target[name(1)] == 1 && target[name(3)] == 3 && !target.exists(name(4));
+	cout << "Node handles " << (ok ? "OK" : "FAILED") << endl;
+}
+
+//20 to 60 byte keys, many sharing long starts, some the start of others, some with bytes above 127
+string randomName(){
+	static const char* starts[] = { "", "tenant/", "tenant/eu-west/", "tenant/eu-west/customer-" };
+	string key = starts[rand() % 4];
+	while (key.size() < 20 || (key.size() < 60 && rand() % 4)) key += char(rand() % 3 ? 'a' + rand() % 4 : 120 + rand() % 16);
+	if (rand() % 8 == 0) key += string(1, '\0') + "x";
+	return key;
+}
+
+template<class Comp>
+bool checkTransparent(int n){
+	GTree<string, long long, Comp> drvo;
+	map<string, long long> check;
+	vector<string> names;
+	for (int i = 0; i < n; i++){
+		names.push_back(randomName());
+		if (rand() % 4 == 0) names.push_back(names.back().substr(0, 20 + rand() % 10));
+	}
+	for (size_t i = 0; i < names.size(); i++){
+		if (rand() % 4){
+			drvo.insert(names[i], i);
+			check[names[i]] = i;
+		}
+	}
+	bool ok = true;
+	auto it = drvo.begin();
+	for (auto& kv : check){
+		ok = ok && it && it.key() == kv.first && it.value() == kv.second;
+		if (it) ++it;
+	}
+	for (const string& name : names){
+		auto kv = check.find(name);
+		bool there = kv != check.end();
+		ok = ok && drvo.exists(name) == there && drvo[name] == (there ? kv->second : 0);
+		auto ge = check.lower_bound(name);
+		auto found = drvo.findGreaterEqual(name);
+		ok = ok && (ge == check.end() ? !found : found && found.key() == ge->first);
+		if (name.find('\0') != string::npos) continue;
+		//found without building a string
+		ok = ok && drvo.exists(name.c_str()) == there && drvo[name.c_str()] == (there ? kv->second : 0);
+		auto smaller = drvo.findSmaller(name.c_str());
+		auto below = check.lower_bound(name);
+		ok = ok && (below == check.begin() ? !smaller : smaller && smaller.key() == (--below)->first);
+#if __cplusplus >= 201703L
+		auto greater = drvo.findGreater(string_view(name));
+		auto gt = check.upper_bound(name);
+		ok = ok && (gt == check.end() ? !greater : greater && greater.key() == gt->first);
+#endif
+	}
+	return ok;
+}
+
+void testTransparent(int n){
+	srand(1818);
+	bool ok = checkTransparent<less<>>(n) && checkTransparent<PrefixLess<>>(n) && checkTransparent<PrefixLess<1>>(n);
+	cout << "Transparent lookup " << (ok ? "OK" : "FAILED") << endl;
+}
+
+//hints anywhere in the tree, reads do not splay so they stay deep; sums and sizes check the repairs
+void testHintedInsert(int n){
+	typedef GTree<int, long long, less<int>, plus<long long>, allocator<pair<const int, long long>>, true, SplayNever> Tree;
+	Tree drvo, other;
+	map<int, long long> check;
+	srand(1919);
+	other.insert(0, 0);
+	bool ok = true;
+	auto hint = drvo.outOfRange();
+	for (int i = 0; i < n; i++){
+		int key = rand() % 4 ? i + rand() % 100 - 50 : rand() % n;
+		bool fresh = check.count(key) == 0;
+		check[key] = i;
+		int pick = rand() % 4;
+		auto from = pick == 0 ? drvo.findGreaterEqual(rand() % n) : pick == 1 ? other.begin() : hint;
+		auto result = drvo.insert(from, key, (long long)i);
+		ok = ok && result.second == fresh && result.first.key() == key && result.first.value() == i;
+		hint = result.first;
+		if (i % 16 == 0){
+			//drive the hint down again
+			auto deep = drvo.kth(rand() % drvo.size());
+			hint = drvo.findEqual(deep.key());
+		}
+	}
+	long long sum = 0;
+	for (auto& kv : check) sum += kv.second;
+	ok = ok && drvo.size() == check.size() && drvo.sum(Range<int>(0, 0, 0, 0)) == sum;
+	auto it = drvo.begin();
+	for (auto& kv : check){
+		ok = ok && it && it.key() == kv.first && it.value() == kv.second;
+		if (it) ++it;
+	}
+	int probe = n / 2;
+	auto below = check.lower_bound(probe);
+	size_t rank = distance(check.begin(), below);
+	ok = ok && drvo.rank(probe) == rank && drvo.countRange(Range<int>(1, -1000, 2, probe)) == rank;
+	//hints taken after a split, each tree with its own and with the other's
+	Tree upper = drvo.splitAt(probe);
+	auto low = drvo.findSmaller(probe), high = upper.findGreaterEqual(probe);
+	for (int i = 0; i < 200; i++){
+		int key = i % 2 ? probe - 1 - rand() % 100 : probe + rand() % 100;
+		check[key] = i;
+		Tree& into = key < probe ? drvo : upper;
+		auto result = into.insert(i % 4 < 2 ? (key < probe ? low : high) : (key < probe ? high : low), key, (long long)i);
+		ok = ok && result.first.key() == key && result.first.value() == i;
+		(key < probe ? low : high) = result.first;
+	}
+	ok = ok && drvo.size() == size_t(distance(check.begin(), check.lower_bound(probe)))
+		&& upper.size() == size_t(distance(check.lower_bound(probe), check.end()));
+	drvo.concat(upper);
+	it = drvo.begin();
+	for (auto& kv : check){
+		ok = ok && it && it.key() == kv.first && it.value() == kv.second;
+		if (it) ++it;
+	}
+	cout << "Hinted insert " << (ok ? "OK" : "FAILED") << endl;
+}
+
+//random ranges cut out of string-keyed trees, freed inline and by a reclaimer
+void testEraseRange(int n){
+	typedef GTree<string, long long, less<string>, plus<long long>, allocator<pair<const string, long long>>, true> Tree;
+	Tree inline_, deferred;
+	map<string, long long> check;
+	Reclaimer reclaimer;
+	srand(2020);
+	auto name = [](int i){ string s = to_string(i); return string(8 - s.size(), '0') + s + "-padding-past-sso"; };
+	for (int i = 0; i < n; i++){
+		string key = name(rand() % (4 * n));
+		inline_.insert(key, i);
+		deferred.insert(key, i);
+		check[key] = i;
+	}
+	bool ok = true;
+	for (int round = 0; round < 200; round++){
+		int a = rand() % (4 * n), b = a + rand() % (n / 10 + 1);
+		Range<string> range(rand() % 3, name(a), rand() % 3, name(b));
+		auto first = range.l_type == 0 ? check.begin() : range.l_type == 1 ? check.lower_bound(range.l_val) : check.upper_bound(range.l_val);
+		auto last = first;
+		size_t count = 0;
+		long long sum = 0;
+		while (last != check.end() && (range.r_type == 0 || last->first < range.r_val || (range.r_type == 1 && last->first == range.r_val))){
+			count++;
+			sum += last->second;
+			++last;
+		}
+		check.erase(first, last);
+		auto now = inline_.eraseRange(range);
+		auto later = deferred.eraseRange(range, reclaimer);
+		ok = ok && now.first == count && now.second == sum && later.first == count && later.second == sum;
+		if (round % 4 == 0 || check.size() < size_t(n / 2)){
+			//refill, partly reusing the slots that came back
+			for (int i = 0; i < n / 20; i++){
+				string key = name(rand() % (4 * n));
+				inline_.insert(key, i);
+				deferred.insert(key, i);
+				check[key] = i;
+			}
+		}
+	}
+	auto it = inline_.begin();
+	auto jt = deferred.begin();
+	for (auto& kv : check){
+		ok = ok && it && jt && it.key() == kv.first && jt.key() == kv.first && it.value() == kv.second && jt.value() == kv.second;
+		if (it) ++it;
+		if (jt) ++jt;
+	}
+	ok = ok && !it && !jt && deferred.size() == check.size();
+	reclaimer.wait();
+	ok = ok && reclaimer.backlog() == 0 && reclaimer.reclaimed() > 0;
+	//once everything came back, erasing and refilling must not need new slabs
+	size_t before = deferred.memoryUsage();
+	size_t gone = deferred.eraseRange(Range<string>(0, "", 0, ""), reclaimer).first;
+	reclaimer.wait();
+	for (size_t i = 0; i < gone; i++) deferred.insert(name(i), i);
+	ok = ok && deferred.memoryUsage() == before;
+	cout << "Range erase " << (ok ? "OK" : "FAILED") << endl;
+}
+
+//Lazy updates for GTreeLazy: either add v to the values or assign v to them
+struct Affine {
+	bool assign;
+	long long v;
+};
+
+struct SumCount {
+	long long sum, count;
+
+	SumCount() : sum(0), count(0) {}
+
+	//a single value
+	SumCount(long long value) : sum(value), count(1) {}
+
+	SumCount(long long s, long long n) : sum(s), count(n) {}
+};
+
+//the later update wins if it assigns, otherwise it adds on top of the earlier one
+Affine operator+(const Affine& earlier, const Affine& later){
+	if (later.assign) return later;
+	return Affine{ earlier.assign, earlier.v + later.v };
+}
+
+long long operator+(const Affine& u, long long value){
+	return u.assign ? u.v : value + u.v;
+}
+
+SumCount operator+(const Affine& u, const SumCount& s){
+	return SumCount(u.assign ? u.v * s.count : s.sum + u.v * s.count, s.count);
+}
+
+struct SumCountAdder {
+	SumCount operator()(const SumCount& a, const SumCount& b)const{
+		return SumCount(a.sum + b.sum, a.count + b.count);
+	}
+
+};
+
+typedef GTreeLazy<int, long long, SumCount, Affine, less<int>, SumCountAdder> LazyTree;
+typedef GTreeLazy<int, long long, SumCount, Affine, less<int>, SumCountAdder,
+	_gtree_plus<Affine, long long, long long>, _gtree_plus<Affine, SumCount, SumCount>, _gtree_plus<Affine, Affine, Affine>,
+	allocator<pair<const int, long long>>, true> CountingLazyTree;
+
+void testLazy(int n){
+	vector<pair<int, long long>> initial;
+	for (int i = 0; i < n; i += 2) initial.push_back(make_pair(i, i));
+	CountingLazyTree drvo;
+	drvo.build(initial.begin(), initial.end());
+	map<int, long long> check(initial.begin(), initial.end());
+	srand(1618);
+	bool ok = true;
+	for (int i = 0; i < n; i++){
+		int a = rand() % n, b = rand() % n;
+		if (b < a) swap(a, b);
+		Range<int> range(1, a, 2, b);
+		switch (rand() % 8){
+		case 0:
+			ok = ok && drvo.erase(a) == (check.erase(a) > 0);
+			break;
+		case 1:
+		case 2: {
+			Affine u = { rand() % 2 == 0, rand() % 100 };
+			drvo.update_range(range, u);
+			for (auto it = check.lower_bound(a); it != check.lower_bound(b); ++it) it->second = u + it->second;
+			break;
+		}
+		case 3: {
+			long long sum = 0, count = 0;
+			for (auto it = check.lower_bound(a); it != check.lower_bound(b); ++it, count++) sum += it->second;
+			SumCount s = drvo.cumulative_value_range(range);
+			ok = ok && s.sum == sum && s.count == count && drvo.count_range(range) == size_t(count);
+			break;
+		}
+		case 4:
+			ok = ok && drvo.get(a) == (check.count(a) ? check[a] : 0);
+			break;
+		case 5:
+			if (!check.empty()){
+				size_t k = a % check.size();
+				ok = ok && drvo.kth(k) == next(check.begin(), k)->first && drvo.rank(a) == size_t(distance(check.begin(), check.lower_bound(a)));
+			}
+			break;
+		default:
+			drvo.set(a, i);
+			check[a] = i;
+		}
+		ok = ok && drvo.size() == check.size();
+	}
+	CountingLazyTree copy(drvo);
+	CountingLazyTree moved(move(drvo));
+	for (auto& kv : check) ok = ok && copy.get(kv.first) == kv.second && moved.get(kv.first) == kv.second;
+	ok = ok && drvo.empty() && copy.size() == check.size();
+	CountingLazyTree& self = copy;
+	copy = move(self);
+	ok = ok && copy.size() == check.size() && copy.get(check.begin()->first) == check.begin()->second;
+	//out of range, the moved-from tree is empty
+	ok = ok && drvo.kth(0) == int() && copy.kth(check.size()) == int() && copy.kth(size_t(-1)) == int();
+	cout << "Lazy range updates " << (ok ? "OK" : "FAILED") << endl;
+}
+
+//Both reclamation modes, on trees whose nodes need destructors
+void testReclaim(int n){
+	typedef GTree<string, long long, less<string>, plus<long long>, allocator<pair<const string, long long>>, true> Tree;
+	auto name = [](int i){ return "reclaimed-key-" + to_string(i); };
+	bool ok = true;
+	{
+		Reclaimer reclaimer;
+		Tree background;
+		background.reclaimInBackground(&reclaimer);
+		for (int i = 0; i < n; i++) background.insert(name(i), i);
+		background.clear();
+		ok = ok && background.empty() && !background.reclaiming();
+		//the tree goes on with a pool of its own while the old one is freed
+		for (int i = 0; i < n / 2; i++) background.insert(name(i), 1);
+		Tree moved(move(background));
+		moved = Tree();
+		reclaimer.wait();
+		ok = ok && reclaimer.backlog() == 0 && reclaimer.reclaimed() == size_t(n + n / 2);
+		moved.insert(name(0), 2);
+		ok = ok && moved.size() == 1 && moved[name(0)] == 2;
+	}
+	{
+		Tree incremental;
+		const size_t step = 64;
+		incremental.reclaimIncrementally(step);
+		for (int i = 0; i < n; i++) incremental.insert(name(i), i);
+		size_t before = incremental.memoryUsage();
+		incremental.clear();
+		ok = ok && incremental.empty() && incremental.reclaiming() && incremental.reclaimedNodes() == 0;
+		long long sum = 0;
+		for (int i = 0; i < n; i++){
+			incremental.insert(name(n - i), i);
+			sum += i;
+			size_t expected = min(size_t(i + 1) * step, size_t(n));
+			ok = ok && incremental.reclaimedNodes() == expected && incremental.reclaiming() == (expected < size_t(n));
+		}
+		//the writes were fed the slots of the dropped nodes, no slab had to be added
+		ok = ok && incremental.memoryUsage() == before && incremental.size() == size_t(n);
+		ok = ok && incremental.sum(Range<string>(0, "", 0, "")) == sum;
+		//whatever is left when the tree goes is freed by the destructor
+		incremental.clear();
+		incremental.insert(name(0), 0);
+	}
+	{
+		Reclaimer reclaimer;
+		GTreeLazy<string, long long> lazy;
+		lazy.reclaim_incrementally(16);
+		for (int i = 0; i < n; i++) lazy.set(name(i), i);
+		lazy.clear();
+		ok = ok && lazy.empty() && lazy.reclaiming();
+		long long sum = 0;
+		for (int i = 0; i < n / 16 + 1; i++){
+			lazy.set(name(i), 1);
+			sum++;
+		}
+		ok = ok && !lazy.reclaiming() && lazy.reclaimed_nodes() == size_t(n);
+		ok = ok && lazy.cumulative_value_range(lazy.all()) == sum;
+		lazy.reclaim_in_background(&reclaimer);
+		lazy.clear();
+		reclaimer.wait();
+		ok = ok && lazy.empty() && reclaimer.reclaimed() == size_t(sum);
+	}
+	cout << "Reclamation " << (ok ? "OK" : "FAILED") << endl;
+}
+
+//random ranges walked both ways by cursors, against the same ranges of a map
+void testRangeCursor(int n){
+	GTree<int, int> drvo;
+	map<int, int> check;
+	srand(2222);
+	for (int i = 0; i < n; i++){
+		int key = rand() % (4 * n);
+		drvo.insert(key, i);
+		check[key] = i;
+	}
+	const GTree<int, int>& view = drvo;
+	bool ok = true;
+	for (int round = 0; round < 500; round++){
+		int a = rand() % (4 * n), b = a + rand() % (n / 5) - n / 50;
+		Range<int> range(rand() % 3, a, rand() % 3, b);
+		vector<pair<int, int>> expected;
+		for (auto& kv : check){
+			bool above = range.l_type == 0 || (range.l_type == 1 ? kv.first >= a : kv.first > a);
+			bool below = range.r_type == 0 || (range.r_type == 1 ? kv.first <= b : kv.first < b);
+			if (above && below) expected.push_back(kv);
+		}
+		size_t i = 0;
+		for (auto c = view.cursor(range); c; ++c, i++){
+			ok = ok && i < expected.size() && c.key() == expected[i].first && c.value() == expected[i].second;
+		}
+		ok = ok && i == expected.size();
+		for (auto c = view.cursor(range, true); c; c++){
+			ok = ok && i > 0 && (*c).first == expected[i - 1].first;
+			i--;
+		}
+		ok = ok && i == 0;
+	}
+	//postfix decrement returns the old position and steps back
+	auto it = drvo.end();
+	auto was = it--;
+	ok = ok && was.key() == check.rbegin()->first && it.key() == next(check.rbegin())->first;
+	cout << "Range cursor " << (ok ? "OK" : "FAILED") << endl;
+}
+
+//ranges exported at once and in chunks, against the same ranges of a map
+void testExportRange(int n){
+	GTree<int, long long> drvo;
+	map<int, long long> check;
+	srand(2323);
+	for (int i = 0; i < n; i++){
+		int key = rand() % (4 * n);
+		drvo.insert(key, i);
+		check[key] = i;
+	}
+	vector<int> keys(n);
+	vector<long long> values(n);
+	bool ok = true;
+	for (int round = 0; round < 300; round++){
+		int a = rand() % (4 * n), b = a + rand() % (n / 5);
+		Range<int> range(rand() % 3, a, rand() % 3, b);
+		vector<pair<int, long long>> expected;
+		for (auto c = drvo.cursor(range); c; ++c) expected.push_back(make_pair(c.key(), c.value()));
+		size_t cap = rand() % 2 ? expected.size() + 1 : rand() % (expected.size() + 1);
+		size_t got = drvo.exportRange(range, keys.data(), values.data(), cap);
+		ok = ok && got == min(cap, expected.size());
+		for (size_t i = 0; i < got; i++) ok = ok && keys[i] == expected[i].first && values[i] == expected[i].second;
+		//chunks of 7, keys only
+		size_t at = 0;
+		size_t total = drvo.exportRange(range, keys.data(), (long long*)0, 7, [&](size_t count){
+			ok = ok && count > 0 && count <= 7 && (count == 7 || at + count == expected.size());
+			for (size_t i = 0; i < count; i++) ok = ok && at + i < expected.size() && keys[i] == expected[at + i].first;
+			at += count;
+		});
+		ok = ok && total == expected.size() && at == total;
+	}
+	ok = ok && drvo.exportRange(Range<int>(0, 0, 0, 0), keys.data(), values.data(), n) == check.size();
+	ok = ok && drvo.exportRange(Range<int>(0, 0, 0, 0), keys.data(), values.data(), 0, [&](size_t){ ok = false; }) == 0;
+	cout << "Range export " << (ok ? "OK" : "FAILED") << endl;
+}
+
+//an empty value type that is not Void, so nodes keep value and totalValue for it as for any other
+struct NoValue {
+	NoValue operator+(const NoValue&) const {
+		return *this;
+	}
+};
+
+static_assert(GTree<long long>::nodeSize() == 3 * sizeof(void*) + sizeof(long long), "Void values must not take space in nodes");
+static_assert(GTree<long long, NoValue>::nodeSize() > GTree<long long>::nodeSize(), "other empty values still do");
+
+//sets, with and without order statistics, against std::set
+void testVoidSet(int n){
+	GTree<int> plain;
+	GTree<int, Void, less<int>, plus<Void>, allocator<pair<const int, Void>>, true> counted;
+	set<int> check;
+	srand(2424);
+	bool ok = true;
+	for (int i = 0; i < 4 * n; i++){
+		int key = rand() % n;
+		if (rand() % 3){
+			plain.insert(key);
+			counted.insert(key);
+			check.insert(key);
+		}
+		else {
+			bool gone = check.erase(key) > 0;
+			ok = ok && plain.erase(key) == gone && counted.erase(key) == gone;
+		}
+	}
+	ok = ok && counted.size() == check.size();
+	auto it = plain.begin();
+	size_t rank = 0;
+	for (int key : check){
+		ok = ok && it && it.key() == key && plain.exists(key);
+		if (rank % 97 == 0) ok = ok && counted.kth(rank).key() == key && counted.rank(key) == rank;
+		if (it) ++it;
+		rank++;
+	}
+	ok = ok && !it;
+	cout << "Void sets " << (ok ? "OK" : "FAILED") << endl;
+}
+
+static_assert(GTreeLazy<int, long long>::node_size() == GTree<int, long long>::nodeSize(),
+	"without lazy updates GTreeLazy nodes must be no bigger than GTree's");
+
+//GTreeLazy with the default NoUpdate, which keeps no updates and never pushes any, against a map
+void testLazyNoUpdate(int n){
+	GTreeLazy<int, long long> drvo;
+	map<int, long long> check;
+	srand(2525);
+	bool ok = true;
+	for (int i = 0; i < 4 * n; i++){
+		int key = rand() % n;
+		switch (rand() % 4){
+		case 0:
+			ok = ok && drvo.erase(key) == (check.erase(key) > 0);
+			break;
+		case 1: {
+			int b = key + rand() % (n / 10);
+			long long sum = 0;
+			for (auto it = check.lower_bound(key); it != check.end() && it->first <= b; ++it) sum += it->second;
+			ok = ok && drvo.cumulative_value_range(drvo.range_inclusive(key, b)) == sum;
+			break;
+		}
+		default:
+			drvo.set(key, i);
+			check[key] = i;
+		}
+	}
+	for (auto& kv : check) ok = ok && drvo.has(kv.first) && drvo.get(kv.first) == kv.second;
+	cout << "Lazy tree without updates " << (ok ? "OK" : "FAILED") << endl;
+}
+
+//moving everything above a cut-off into an archive and back, on both tree kinds
+void testSplitAt(int n){
+	GTree<int, long long> drvo;
+	LazyTree lazy;
+	map<int, long long> check;
+	srand(2024);
+	for (int i = 0; i < n; i++){
+		int a = rand() % n;
+		drvo.insert(a, a);
+		lazy.set(a, a);
+		check[a] = a;
+	}
+	bool ok = true;
+	for (int round = 0; round < 20; round++){
+		int cut = rand() % n;
+		bool inclusive = round % 2 == 0;
+		GTree<int, long long> archive = drvo.splitAt(cut, inclusive);
+		LazyTree lazyArchive = lazy.split_at(cut, inclusive);
+		//updates pending in the archive must survive the trip back
+		lazyArchive.update_range(lazyArchive.all(), Affine{ false, 1 });
+		long long below = 0, above = 0;
+		for (auto& kv : check){
+			if (kv.first > cut || (inclusive && kv.first == cut)){
+				kv.second++;
+				above += kv.second;
+			}
+			else below += kv.second;
+		}
+		ok = ok && drvo.sum(Range<int>(0, 0, 0, 0)) == below;
+		ok = ok && lazy.cumulative_value_range(lazy.all()).sum == below && lazyArchive.cumulative_value_range(lazyArchive.all()).sum == above;
+		ok = ok && (inclusive ? !archive.exists(cut - 1) && !drvo.exists(cut) : !archive.exists(cut) && !drvo.exists(cut + 1));
+		for (auto it = archive.begin(); it; ++it) archive.insert(it.key(), it.value() + 1);
+		drvo.append(move(archive));
+		lazy.append(move(lazyArchive));
+		ok = ok && archive.empty() && lazyArchive.empty();
+	}
+	auto it = drvo.begin();
+	for (auto& kv : check){
+		if (!it || it.key() != kv.first || it.value() != kv.second || lazy.get(kv.first) != kv.second) ok = false;
+		if (it) ++it;
+	}
+	cout << "Split at and append " << (ok && !it ? "OK" : "FAILED") << endl;
+}
+
+const int benchSize = 1000000;
+
+//Insert/erase churn on random keys, the node pool recycles erased nodes
+void benchChurnGTree(){
+	GTree<int, int> drvo;
+	srand(1);
+	for (int i = 0; i < benchSize; i++){
+		drvo.insert(rand(), i);
+		drvo.erase(rand());
+	}
+}
+
+//The same churn through the heap, one allocation per node
+void benchChurnMap(){
+	map<int, int> drvo;
+	srand(1);
+	for (int i = 0; i < benchSize; i++){
+		drvo[rand()] = i;
+		drvo.erase(rand());
+	}
+}
+
+void benchClear(){
+	GTree<int, int> drvo;
+	for (int round = 0; round < 10; round++){
+		for (int i = 0; i < benchSize; i++) drvo.insert(i, i);
+		drvo.clear();
+	}
+}
+
+const int layoutBenchSize = 10000000;
+
+//rand() may be as narrow as 15 bits
+int bigRandom(){
+	return int(unsigned(rand()) * (unsigned(RAND_MAX) + 1u) + unsigned(rand()));
+}
+
+template<class Tree>
+void benchLayout(Tree& drvo){
+	srand(3);
+	for (int i = 0; i < layoutBenchSize; i++) drvo.insert(bigRandom(), i);
+	long long found = 0;
+	for (int i = 0; i < layoutBenchSize; i++) found += drvo.exists(bigRandom());
+	cout << "(" << drvo.memoryUsage() / (1 << 20) << " MB, " << found << " found) ";
+}
+
+void benchLayoutPointers(){
+	GTree<int, int> drvo;
+	benchLayout(drvo);
+}
+
+void benchLayoutCompact(){
+	GTreeCompact<int, int> drvo;
+	drvo.reserve(layoutBenchSize);
+	benchLayout(drvo);
+}
+
+template<class Tree>
+void benchSplay(){
+	Tree drvo;
+	srand(5);
+	for (int i = 0; i < benchSize; i++) drvo.insert(bigRandom(), i);
+	for (int i = 0; i < benchSize; i++) drvo.exists(bigRandom());
+	for (int i = 0; i < benchSize; i++) drvo.findGreaterEqual(bigRandom());
+	srand(5);
+	for (int i = 0; i < benchSize; i++) drvo.erase(bigRandom());
+}
+
+vector<pair<int, int>> shuffledInput(){
+	vector<pair<int, int>> input;
+	for (int i = 0; i < layoutBenchSize; i++) input.push_back(make_pair(i, i));
+	srand(6);
+	for (int i = layoutBenchSize - 1; i > 0; i--) swap(input[i], input[bigRandom() % unsigned(i + 1)]);
+	return input;
+}
+
+void benchBuildInsert(){
+	vector<pair<int, int>> input = shuffledInput();
+	GTree<int, int> drvo;
+	for (auto& kv : input) drvo.insert(kv.first, kv.second);
+}
+
+void benchBuildBulk(){
+	vector<pair<int, int>> input = shuffledInput();
+	GTree<int, int> drvo(input.begin(), input.end());
+}
+
+void benchBuildSorted(){
+	vector<pair<int, int>> input = shuffledInput();
+	sort(input.begin(), input.end());
+	GTree<int, int> drvo(input.begin(), input.end());
+}
+
+const int batchCount = 100;
+const int batchSize = 50000;
+
+vector<pair<int, int>> randomBatch(){
+	vector<pair<int, int>> batch;
+	for (int i = 0; i < batchSize; i++) batch.push_back(make_pair(bigRandom(), i));
+	return batch;
+}
+
+void benchBatchLoop(){
+	GTree<int, int> drvo;
+	srand(8);
+	for (int b = 0; b < batchCount; b++){
+		vector<pair<int, int>> batch = randomBatch();
+		for (auto& kv : batch) drvo.insert(kv.first, kv.second);
+	}
+}
+
+void benchBatchMerge(){
+	GTree<int, int> drvo;
+	srand(8);
+	for (int b = 0; b < batchCount; b++) drvo.insertBatch(randomBatch());
+}
+
+const int sumQueries = 1000;
+
+//ranges cover a tenth of the keys on average
+void benchSumIterators(){
+	GTree<int, long long> drvo;
+	for (int i = 0; i < benchSize; i++) drvo.insert(i, i);
+	srand(9);
+	long long total = 0;
+	for (int q = 0; q < sumQueries; q++){
+		int a = bigRandom() % unsigned(benchSize), b = a + bigRandom() % unsigned(benchSize / 5);
+		for (auto it = drvo.findGreaterEqual(a); it && it.key() <= b; ++it) total += it.value();
+	}
+	cout << "(" << total << ") ";
+}
+
+//cursors do not splay, so the tree is built balanced instead of as the spine in-order inserts leave
+void benchSumCursor(){
+	vector<pair<int, long long>> keys;
+	for (int i = 0; i < benchSize; i++) keys.push_back(make_pair(i, (long long)i));
+	const GTree<int, long long> drvo(keys.begin(), keys.end());
+	srand(9);
+	long long total = 0;
+	for (int q = 0; q < sumQueries; q++){
+		int a = bigRandom() % unsigned(benchSize), b = a + bigRandom() % unsigned(benchSize / 5);
+		for (auto c = drvo.cursor(Range<int>(1, a, 1, b)); c; ++c) total += c.value();
+	}
+	cout << "(" << total << ") ";
+}
+
+//the values go out in chunks of 4096 and are summed by a plain loop over the array
+void benchSumExport(){
+	vector<pair<int, long long>> keys;
+	for (int i = 0; i < benchSize; i++) keys.push_back(make_pair(i, (long long)i));
+	const GTree<int, long long> drvo(keys.begin(), keys.end());
+	vector<long long> values(4096);
+	srand(9);
+	long long total = 0;
+	for (int q = 0; q < sumQueries; q++){
+		int a = bigRandom() % unsigned(benchSize), b = a + bigRandom() % unsigned(benchSize / 5);
+		drvo.exportRange(Range<int>(1, a, 1, b), (int*)0, values.data(), values.size(), [&](size_t count){
+			for (size_t i = 0; i < count; i++) total += values[i];
+		});
+	}
+	cout << "(" << total << ") ";
+}
+
+//the same sums over a linked list holding the keys in order, as the lower bound for a scan
+void benchSumList(){
+	list<pair<int, long long>> keys;
+	vector<list<pair<int, long long>>::iterator> at;
+	for (int i = 0; i < benchSize; i++) at.push_back(keys.insert(keys.end(), make_pair(i, (long long)i)));
+	srand(9);
+	long long total = 0;
+	for (int q = 0; q < sumQueries; q++){
+		int a = bigRandom() % unsigned(benchSize), b = a + bigRandom() % unsigned(benchSize / 5);
+		for (auto it = at[a]; it != keys.end() && it->first <= b; ++it) total += it->second;
+	}
+	cout << "(" << total << ") ";
+}
+
+void benchSumSplit(){
+	GTree<int, long long> drvo;
+	for (int i = 0; i < benchSize; i++) drvo.insert(i, i);
+	srand(9);
+	long long total = 0;
+	for (int q = 0; q < sumQueries; q++){
+		int a = bigRandom() % unsigned(benchSize), b = a + bigRandom() % unsigned(benchSize / 5);
+		total += drvo.sum(Range<int>(1, a, 1, b));
+	}
+	cout << "(" << total << ") ";
+}
+
+const int lazyQueries = 200;
+
+//adds to ranges of a tenth of the keys on average, key by key
+void benchLazyLoop(){
+	LazyTree drvo;
+	for (int i = 0; i < benchSize; i++) drvo.set(i, i);
+	srand(10);
+	for (int q = 0; q < lazyQueries; q++){
+		int a = bigRandom() % unsigned(benchSize), b = a + bigRandom() % unsigned(benchSize / 5);
+		Affine u = { false, q };
+		for (int k = a; k <= b && k < benchSize; k++) drvo.set(k, u + drvo.get(k));
+	}
+	cout << "(" << drvo.cumulative_value_range(drvo.all()).sum << ") ";
+}
+
+void benchLazyRange(){
+	LazyTree drvo;
+	for (int i = 0; i < benchSize; i++) drvo.set(i, i);
+	srand(10);
+	for (int q = 0; q < lazyQueries; q++){
+		int a = bigRandom() % unsigned(benchSize), b = a + bigRandom() % unsigned(benchSize / 5);
+		drvo.update_range(drvo.range_inclusive(a, b), Affine{ false, q });
+	}
+	cout << "(" << drvo.cumulative_value_range(drvo.all()).sum << ") ";
+}
+
+//the same point workload on GTree and on GTreeLazy without lazy updates:
+//1M keys set in random order, 1M reads, range sums over a tenth of the keys
+template<bool lazy>
+void benchPointWorkload(){
+	GTree<int, long long> tree;
+	GTreeLazy<int, long long> lazyTree;
+	vector<int> keys;
+	for (int i = 0; i < benchSize; i++) keys.push_back(i);
+	srand(25);
+	for (int i = benchSize - 1; i > 0; i--) swap(keys[i], keys[bigRandom() % unsigned(i + 1)]);
+	for (int key : keys){
+		if (lazy) lazyTree.set(key, key);
+		else tree.insert(key, key);
+	}
+	long long total = 0;
+	for (int i = 0; i < benchSize; i++){
+		int key = keys[unsigned(bigRandom()) % benchSize];
+		total += lazy ? lazyTree.get(key) : tree[key];
+	}
+	for (int q = 0; q < sumQueries; q++){
+		int a = bigRandom() % unsigned(benchSize), b = a + bigRandom() % unsigned(benchSize / 5);
+		total += lazy ? lazyTree.cumulative_value_range(lazyTree.range_inclusive(a, b)) : tree.sum(Range<int>(1, a, 1, b));
+	}
+	cout << "(" << total << ") ";
+}
+
+const int readQueries = 5000000;
+
+//keys drawn uniformly or from a Zipf distribution (s = 1) over keys ranked in random order
+const vector<int>& readQueryKeys(bool zipf){
+	static vector<int> keys[2];
+	vector<int>& q = keys[zipf];
+	if (!q.empty()) return q;
+	vector<int> byRank;
+	for (int i = 0; i < benchSize; i++) byRank.push_back(2 * i);
+	srand(11);
+	for (int i = benchSize - 1; i > 0; i--) swap(byRank[i], byRank[bigRandom() % unsigned(i + 1)]);
+	vector<double> cdf;
+	double total = 0;
+	for (int i = 0; i < benchSize; i++) cdf.push_back(total += 1.0 / (i + 1));
+	for (int i = 0; i < readQueries; i++){
+		unsigned r = bigRandom() % unsigned(benchSize);
+		if (zipf) r = unsigned(lower_bound(cdf.begin(), cdf.end(), total * (bigRandom() % 1000000) / 1000000) - cdf.begin());
+		q.push_back(byRank[r]);
+	}
+	return q;
+}
+
+//95% lookups, 5% inserts of keys that are not there yet, on a tree that starts out balanced
+template<class Policy, bool zipf>
+void benchReads(){
+	const vector<int>& q = readQueryKeys(zipf);
+	vector<pair<int, int>> input;
+	for (int i = 0; i < benchSize; i++) input.push_back(make_pair(2 * i, i));
+	GTree<int, int, less<int>, plus<int>, allocator<pair<const int, int>>, false, Policy> drvo(input.begin(), input.end());
+	long long found = 0;
+	for (int i = 0; i < readQueries; i++){
+		if (i % 20 == 0) drvo.insert(q[i] + 1, i);
+		else found += drvo.exists(q[i]);
+	}
+	cout << "(" << found << ") ";
+}
+
+//uniform lookups of the read benchmark, through the tree and through a frozen snapshot
+void benchLookupTree(){
+	const vector<int>& q = readQueryKeys(false);
+	GTree<int, int> drvo;
+	for (int i = 0; i < benchSize; i++) drvo.insert(2 * i, i);
+	long long found = 0;
+	for (int i = 0; i < readQueries; i++) found += drvo.findGreaterEqual(q[i] - 1).key();
+	cout << "(" << found << ") ";
+}
+
+void benchLookupSnapshot(){
+	const vector<int>& q = readQueryKeys(false);
+	GTree<int, int> drvo;
+	for (int i = 0; i < benchSize; i++) drvo.insert(2 * i, i);
+	GTree<int, int>::Snapshot snapshot = drvo.freeze();
+	long long found = 0;
+	for (int i = 0; i < readQueries; i++) found += snapshot.findGreaterEqual(q[i] - 1).key();
+	cout << "(" << found << ") ";
+}
+
+//the same lookups split among 4 threads
+void benchLookupSnapshotThreads(){
+	const vector<int>& q = readQueryKeys(false);
+	GTree<int, int> drvo;
+	for (int i = 0; i < benchSize; i++) drvo.insert(2 * i, i);
+	const GTree<int, int>::Snapshot snapshot = drvo.freeze();
+	long long found[4];
+	vector<thread> readers;
+	for (int t = 0; t < 4; t++) readers.push_back(thread([&, t](){
+		found[t] = 0;
+		for (int i = t; i < readQueries; i += 4) found[t] += snapshot.findGreaterEqual(q[i] - 1).key();
+	}));
+	for (auto& reader : readers) reader.join();
+	cout << "(" << found[0] + found[1] + found[2] + found[3] << ") ";
+}
+
+const int snapshotRounds = 100;
+
+//a million keys, a snapshot for reporting after every 10k updates
+template<class Tree>
+void benchSnapshots(){
+	Tree drvo;
+	srand(12);
+	for (int i = 0; i < benchSize; i++) drvo.insert(bigRandom(), i);
+	long long found = 0;
+	for (int round = 0; round < snapshotRounds; round++){
+		for (int i = 0; i < benchSize / snapshotRounds; i++) drvo.insert(bigRandom(), i);
+		Tree snapshot(drvo);
+		found += snapshot.exists(bigRandom());
+	}
+	cout << "(" << found << ") ";
+}
+
+const int sharedOps = 1000000;
+
+//the same map behind a single lock
+template<class Map>
+struct Locked {
+	Map m;
+	mutex lock;
+
+	bool insert(int key, int value){
+		lock_guard<mutex> guard(lock);
+		return m.insert(make_pair(key, value)).second;
+	}
+
+	bool erase(int key){
+		lock_guard<mutex> guard(lock);
+		return m.erase(key) > 0;
+	}
+
+	bool exists(int key){
+		lock_guard<mutex> guard(lock);
+		return m.count(key) > 0;
+	}
+};
+
+//std::map lookalike over GTree, for Locked
+struct GTreeMap {
+	GTree<int, int> drvo;
+
+	pair<int, bool> insert(const pair<int, int>& kv){
+		return make_pair(0, drvo.insert(kv.first, kv.second).second);
+	}
+
+	size_t erase(int key){
+		return drvo.erase(key);
+	}
+
+	size_t count(int key){
+		return drvo.exists(key);
+	}
+};
+
+//50% lookups, 25% inserts, 25% erases over 2M keys, shared among the threads
+template<class Shared>
+void benchSharedThroughput(const char* name){
+	cout << name << " throughput (Mops/s by thread count):";
+	for (int threads = 1; threads <= 32; threads *= 2){
+		Shared shared;
+		for (int i = 0; i < sharedOps; i++) shared.insert(2 * i, i);
+		auto t = chrono::steady_clock::now();
+		vector<thread> workers;
+		for (int w = 0; w < threads; w++) workers.push_back(thread([&shared, w, threads](){
+			unsigned state = 777 + w;
+			for (int i = w; i < sharedOps; i += threads){
+				state = state * 1103515245u + 12345u;
+				int key = int((state >> 4) % unsigned(2 * sharedOps));
+				switch (state >> 30){
+				case 0:
+					shared.insert(key, i);
+					break;
+				case 1:
+					shared.erase(key);
+					break;
+				default:
+					shared.exists(key);
+				}
+			}
+		}));
+		for (auto& worker : workers) worker.join();
+		chrono::duration<double> passed = chrono::steady_clock::now() - t;
+		cout << " " << threads << ": " << sharedOps / passed.count() / 1e6;
+	}
+	cout << endl;
+}
+
+//a million keys, the upper tenth gets moved into an archive, 20 times over
+void benchArchiveLoop(){
+	GTree<int, int> drvo;
+	for (int i = 0; i < benchSize; i++) drvo.insert(i, i);
+	for (int round = 0; round < 20; round++){
+		GTree<int, int> archive;
+		int cut = benchSize - benchSize / 10;
+		for (auto it = drvo.findGreaterEqual(cut); it; ++it) archive.insert(it.key(), it.value());
+		for (int i = cut; i < benchSize; i++) drvo.erase(i);
+		for (auto it = archive.begin(); it; ++it) drvo.insert(it.key(), it.value());
+	}
+}
+
+void benchArchiveSplit(){
+	GTree<int, int> drvo;
+	for (int i = 0; i < benchSize; i++) drvo.insert(i, i);
+	for (int round = 0; round < 20; round++){
+		GTree<int, int> archive = drvo.splitAt(benchSize - benchSize / 10);
+		drvo.append(move(archive));
+	}
+}
+
+//a day of 2M random keys, sorted so that the trees can be bulk built
+vector<pair<int, int>> dailyKeys(){
+	vector<pair<int, int>> day;
+	for (int i = 0; i < 2 * benchSize; i++) day.push_back(make_pair(bigRandom(), 1));
+	sort(day.begin(), day.end());
+	return day;
+}
+
+//two days merged into one
+void benchUnionLoop(){
+	srand(13);
+	vector<pair<int, int>> first = dailyKeys(), second = dailyKeys();
+	GTree<int, int> today(first.begin(), first.end()), yesterday(second.begin(), second.end());
+	for (auto it = yesterday.begin(); it; ++it) today.insert(it.key(), today[it.key()] + it.value());
+}
+
+void benchUnionJoin(){
+	srand(13);
+	vector<pair<int, int>> first = dailyKeys(), second = dailyKeys();
+	GTree<int, int> today(first.begin(), first.end()), yesterday(second.begin(), second.end());
+	today.unionWith(move(yesterday));
+}
+
+vector<string> stringKeys(){
+	srand(17);
+	vector<string> keys;
+	for (int i = 0; i < benchSize; i++) keys.push_back("customer-" + to_string(bigRandom()));
+	return keys;
+}
+
+//moves every other key to a second tree and back, by copying or by node handles
+template<bool handles>
+void benchMoveStrings(){
+	vector<string> keys = stringKeys();
+	GTree<string, long long> from, to;
+	for (size_t i = 0; i < keys.size(); i++) from.emplace(move(keys[i]), i);
+	size_t length = 0;
+	for (int round = 0; round < 2; round++){
+		auto it = from.begin();
+		while (it){
+			string key = it.key();
+			++it;
+			if (it) ++it;
+			if (handles) to.insert(from.extract(key));
+			else {
+				to.insert(key, from[key]);
+				from.erase(key);
+			}
+		}
+		for (auto it = to.begin(); it; ++it) length += it.key().size();
+		swap(from, to);
+	}
+	if (!length) cout << "empty ";
+}
+
+//1M names of 20 to 60 bytes, looked up through const char*, 5M times
+template<class Comp>
+void benchNameLookups(){
+	srand(18);
+	vector<string> names;
+	for (int i = 0; i < benchSize; i++) names.push_back(randomName());
+	GTree<string, int, Comp> drvo;
+	for (int i = 0; i < benchSize; i++) drvo.insert(names[i], i);
+	const GTree<string, int, Comp>& reader = drvo; //no splaying, the comparisons are what is measured
+	long long found = 0;
+	for (int i = 0; i < readQueries; i++){
+		found += reader.exists(names[unsigned(bigRandom()) % benchSize].c_str());
+	}
+	if (!found) cout << "none found ";
+}
+
+//time-series keys: in order, backwards, or each a few places off its spot
+vector<int> streamKeys(int kind){
+	srand(19);
+	vector<int> keys(layoutBenchSize);
+	for (int i = 0; i < layoutBenchSize; i++) keys[i] = kind == 1 ? layoutBenchSize - i : i;
+	if (kind == 2){
+		for (int i = 0; i + 64 < layoutBenchSize; i++) swap(keys[i], keys[i + rand() % 64]);
+	}
+	return keys;
+}
+
+//Hinted inserts pass the iterator of the previous insert
+template<int kind, bool hinted>
+void benchStream(){
+	vector<int> keys = streamKeys(kind);
+	GTree<int, int> drvo;
+	auto hint = drvo.outOfRange();
+	for (int key : keys){
+		if (hinted) hint = drvo.insert(hint, key, key).first;
+		else drvo.insert(key, key);
+	}
+}
+
+template<int kind>
+void benchStreamMap(){
+	vector<int> keys = streamKeys(kind);
+	map<int, int> drvo;
+	auto hint = drvo.end();
+	for (int key : keys) hint = drvo.insert(hint, make_pair(key, key));
+}
+
+//a sliding window over a time series: 2M keys, 40 times the oldest 50k expire and 50k new ones come
+//mode 0 erases key by key, 1 uses eraseRange, 2 eraseRange with a reclaimer
+template<int mode>
+void benchExpire(){
+	GTree<int, int, less<int>, plus<int>, allocator<pair<const int, int>>, true> drvo;
+	Reclaimer reclaimer;
+	const int window = 2000000, step = 50000;
+	for (int i = 0; i < window; i++) drvo.insert(i, 1);
+	for (int round = 0; round < 40; round++){
+		int oldest = round * step;
+		if (mode == 0){
+			for (int key = oldest; key < oldest + step; key++) drvo.erase(key);
+		}
+		else if (mode == 1) drvo.eraseRange(Range<int>(0, 0, 2, oldest + step));
+		else drvo.eraseRange(Range<int>(0, 0, 2, oldest + step), reclaimer);
+		for (int key = oldest + window; key < oldest + window + step; key++) drvo.insert(key, 1);
+	}
+}
+
+//20 times 200k string keys are inserted and the tree is cleared, then 200k lookups follow
+//mode 0 frees the nodes inside clear(), 1 on a reclaimer, 2 64 at a time on the next writes
+template<int mode>
+void benchDrop(){
+	Reclaimer reclaimer; //must outlive the tree
+	GTree<string, int> drvo;
+	if (mode == 1) drvo.reclaimInBackground(&reclaimer);
+	if (mode == 2) drvo.reclaimIncrementally(64);
+	const int n = 200000;
+	for (int round = 0; round < 20; round++){
+		for (int i = 0; i < n; i++) drvo.insert("dropped-key-" + to_string(round * n + i), i);
+		drvo.clear();
+		for (int i = 0; i < n; i++) drvo.exists("dropped-key-" + to_string(i));
+	}
+}
+
+//a set workload: 300k random keys in, 1.2M lookups, all erased again.
+//Void drops value and aggregate from the nodes and repairs nothing, NoValue keeps both
+template<class ValueT>
+void benchSet(){
+	GTree<long long, ValueT, less<long long>, plus<ValueT>, allocator<pair<const long long, ValueT>>> drvo;
+	srand(24);
+	const int n = 300000;
+	vector<long long> keys;
+	for (int i = 0; i < n; i++) keys.push_back(bigRandom());
+	for (long long key : keys) drvo.insert(key);
+	size_t found = 0;
+	for (int i = 0; i < 4 * n; i++) found += drvo.exists(keys[unsigned(bigRandom()) % n]);
+	for (long long key : keys) drvo.erase(key);
+	cout << "(" << found << " found, " << drvo.memoryUsage() / 1000000 << " MB) ";
+}
+
+void bench(){
+	cout << "GTree insert/erase churn: ";
+	timeTest(benchChurnGTree);
+	cout << "map insert/erase churn: ";
+	timeTest(benchChurnMap);
+	cout << "GTree fill and clear: ";
+	timeTest(benchClear);
+	cout << "10M keys, pointer nodes: ";
+	timeTest(benchLayoutPointers);
+	cout << "10M keys, 32-bit index nodes: ";
+	timeTest(benchLayoutCompact);
+	cout << "10M shuffled keys, insert loop: ";
+	timeTest(benchBuildInsert);
+	cout << "10M shuffled keys, bulk build: ";
+	timeTest(benchBuildBulk);
+	cout << "10M shuffled keys, sorted then bulk built: ";
+	timeTest(benchBuildSorted);
+	cout << "100 batches of 50k keys, insert loop: ";
+	timeTest(benchBatchLoop);
+	cout << "100 batches of 50k keys, insertBatch: ";
+	timeTest(benchBatchMerge);
+	cout << "Range sums over iterators: ";
+	timeTest(benchSumIterators);
+	cout << "Range sums over cursors: ";
+	timeTest(benchSumCursor);
+	cout << "Range sums over exported chunks: ";
+	timeTest(benchSumExport);
+	cout << "Range sums over a linked list: ";
+	timeTest(benchSumList);
+	cout << "Range sums by split: ";
+	timeTest(benchSumSplit);
+	cout << "Archiving by insert and erase: ";
+	timeTest(benchArchiveLoop);
+	cout << "Archiving by splitAt and append: ";
+	timeTest(benchArchiveSplit);
+	cout << "Union of 2M keys, insert loop: ";
+	timeTest(benchUnionLoop);
+	cout << "Union of 2M keys, unionWith: ";
+	timeTest(benchUnionJoin);
+	cout << "Moving 1M string keys between trees, insert and erase: ";
+	timeTest(benchMoveStrings<false>);
+	cout << "Moving 1M string keys between trees, node handles: ";
+	timeTest(benchMoveStrings<true>);
+	cout << "Name lookups, less<string>: ";
+	timeTest(benchNameLookups<less<string>>);
+	cout << "Name lookups, transparent less<>: ";
+	timeTest(benchNameLookups<less<>>);
+	cout << "Name lookups, PrefixLess<2>: ";
+	timeTest(benchNameLookups<PrefixLess<2>>);
+	cout << "10M sorted keys, insert: ";
+	timeTest(benchStream<0, false>);
+	cout << "10M sorted keys, hinted insert: ";
+	timeTest(benchStream<0, true>);
+	cout << "10M sorted keys, hinted map insert: ";
+	timeTest(benchStreamMap<0>);
+	cout << "10M reverse-sorted keys, insert: ";
+	timeTest(benchStream<1, false>);
+	cout << "10M reverse-sorted keys, hinted insert: ";
+	timeTest(benchStream<1, true>);
+	cout << "10M reverse-sorted keys, hinted map insert: ";
+	timeTest(benchStreamMap<1>);
+	cout << "10M jittered keys, insert: ";
+	timeTest(benchStream<2, false>);
+	cout << "10M jittered keys, hinted insert: ";
+	timeTest(benchStream<2, true>);
+	cout << "10M jittered keys, hinted map insert: ";
+	timeTest(benchStreamMap<2>);
+	cout << "Expiring a window key by key: ";
+	timeTest(benchExpire<0>);
+	cout << "Expiring a window with eraseRange: ";
+	timeTest(benchExpire<1>);
+	cout << "Expiring a window with eraseRange and a reclaimer: ";
+	timeTest(benchExpire<2>);
+	cout << "Dropping 200k string keys inline: ";
+	timeTest(benchDrop<0>);
+	cout << "Dropping 200k string keys on a reclaimer: ";
+	timeTest(benchDrop<1>);
+	cout << "Dropping 200k string keys incrementally: ";
+	timeTest(benchDrop<2>);
+	cout << "Set of 300k keys, Void values: ";
+	timeTest(benchSet<Void>);
+	cout << "Set of 300k keys, empty struct values: ";
+	timeTest(benchSet<NoValue>);
+	cout << "Range adds, set per key: ";
+	timeTest(benchLazyLoop);
+	cout << "Range adds, update_range: ";
+	timeTest(benchLazyRange);
+	cout << "Point workload, GTree: ";
+	timeTest(benchPointWorkload<false>);
+	cout << "Point workload, GTreeLazy without updates: ";
+	timeTest(benchPointWorkload<true>);
+	readQueryKeys(false);
+	readQueryKeys(true);
+	cout << "Uniform reads, always splay: ";
+	timeTest(benchReads<SplayAlways, false>);
+	cout << "Uniform reads, never splay: ";
+	timeTest(benchReads<SplayNever, false>);
+	cout << "Uniform reads, splay deeper than 20: ";
+	timeTest(benchReads<SplayDeeperThan<20>, false>);
+	cout << "Uniform reads, splay 10%: ";
+	timeTest(benchReads<SplayRandomly<10>, false>);
+	cout << "Zipf reads, always splay: ";
+	timeTest(benchReads<SplayAlways, true>);
+	cout << "Zipf reads, never splay: ";
+	timeTest(benchReads<SplayNever, true>);
+	cout << "Zipf reads, splay deeper than 20: ";
+	timeTest(benchReads<SplayDeeperThan<20>, true>);
+	cout << "Zipf reads, splay 10%: ";
+	timeTest(benchReads<SplayRandomly<10>, true>);
+	cout << "Lookups, splay tree: ";
+	timeTest(benchLookupTree);
+	cout << "Lookups, frozen snapshot: ";
+	timeTest(benchLookupSnapshot);
+	cout << "Lookups, frozen snapshot on 4 threads: ";
+	timeTest(benchLookupSnapshotThreads);
+	cout << "Snapshots by copying: ";
+	timeTest(benchSnapshots<GTree<int, int>>);
+	cout << "Snapshots of a persistent tree: ";
+	timeTest(benchSnapshots<GTreePersistent<int, int>>);
+	benchSharedThroughput<GTreeCombining<int, int>>("Flat combining GTree");
+	benchSharedThroughput<Locked<GTreeMap>>("Mutex and GTree");
+	benchSharedThroughput<ShardedGTree<int, int>>("Sharded GTree");
+	benchSharedThroughput<Locked<map<int, int>>>("Mutex and map");
+	cout << "Bottom-up splay: ";
+	timeTest(benchSplay<GTree<int, int>>);
+	cout << "Top-down splay: ";
+	timeTest(benchSplay<GTreeTopDown<int, int>>);
+}
+
+int main(int argc, char* argv[]){
 	testIterator(population());
 	testFind(population());
+	testDestructor(100000);
+	testPool(100000);
+	testAllocator();
+	testCompact(100000);
+	testTopDown(20000);
+	testBuild(100000);
+	testInsertBatch(5000);
+	testOrderStatistics(5000);
+	testSum(5000);
+	testLazy(5000);
+	testSplayPolicies(5000);
+	testSnapshot(5000);
+	testPersistent(20000);
+	testCombining(20000);
+	testSplitConcat(20000);
+	testSplitAt(5000);
+	testSetOperations(50000);
+	testSharded(20000);
+	testShardedMemory(5000);
+	testNodeHandles(20000);
+	testTransparent(5000);
+	testHintedInsert(20000);
+	testEraseRange(20000);
+	testReclaim(20000);
+	testRangeCursor(20000);
+	testExportRange(20000);
+	testVoidSet(20000);
+	testLazyNoUpdate(20000);
+	if (argc > 1 && string(argv[1]) == "bench") bench();
 	system("pause");
 }
\ No newline at end of file